@@ -0,0 +1,253 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_profile.h"
+
+bool allocation_profiling = false;
+size_t allocation_sample_interval = ALLOCATION_SAMPLE_INTERVAL;
+char *allocation_profile_path = NULL;
+size_t profiled_bytes = 0;
+
+/**
+ * Allocation profiler. Every instruction that may allocate, new, the array
+ * creations, ldc of a string, invokedynamic string concatenation and calls
+ * of native methods, charges what the heap counters grew by since the last
+ * charge to its site, the method and pc of the instruction. Allocations of
+ * methods it calls are charged to their own sites first, so only those made
+ * by the instruction itself are left.
+ *
+ * To keep the cost of profiling low only one allocated byte in
+ * allocation_sample_interval is sampled, the allocation covering it being
+ * charged with the interval. The larger an allocation, the more likely it is
+ * sampled, so the bytes of a site are estimated without bias, and its
+ * objects in proportion. An interval of 1 counts every byte exactly.
+ */
+
+/* initial capacity of the table of sites, a power of 2 */
+#define SITE_TABLE_CAPACITY 256
+
+typedef struct {
+    class_file_t *clazz; /* of the method, NULL for an empty slot */
+    method_t *method;
+    u4 pc;
+    size_t samples;
+    double bytes; /* estimated from the samples */
+    double objects;
+} alloc_site_t;
+
+static struct {
+    alloc_site_t *sites; /* open addressing, keyed by method and pc */
+    size_t capacity;
+    size_t count;
+    size_t samples;
+    size_t objects;      /* allocated_objects when profiled_bytes was */
+    size_t next_sample;  /* bytes to allocate until the next sample */
+} profile;
+
+static size_t site_hash(method_t *method, u4 pc, size_t capacity)
+{
+    uintptr_t key = (uintptr_t) method ^ ((uintptr_t) pc << 16);
+    key *= (uintptr_t) 0x9e3779b97f4a7c15ULL;
+    return (key >> 16) & (capacity - 1);
+}
+
+static alloc_site_t *find_site_slot(alloc_site_t *sites,
+                                    size_t capacity,
+                                    method_t *method,
+                                    u4 pc)
+{
+    size_t i = site_hash(method, pc, capacity);
+    while (sites[i].clazz &&
+           (sites[i].method != method || sites[i].pc != pc))
+        i = (i + 1) & (capacity - 1);
+    return &sites[i];
+}
+
+static void grow_sites()
+{
+    size_t capacity = profile.capacity * 2;
+    alloc_site_t *sites = calloc(capacity, sizeof(alloc_site_t));
+    assert(sites && "Failed to allocate allocation sites");
+    for (size_t i = 0; i < profile.capacity; i++) {
+        alloc_site_t *site = &profile.sites[i];
+        if (site->clazz)
+            *find_site_slot(sites, capacity, site->method, site->pc) = *site;
+    }
+    free(profile.sites);
+    profile.sites = sites;
+    profile.capacity = capacity;
+}
+
+void init_allocation_profile()
+{
+    if (!allocation_profiling)
+        return;
+    profile.capacity = SITE_TABLE_CAPACITY;
+    profile.sites = calloc(profile.capacity, sizeof(alloc_site_t));
+    assert(profile.sites && "Failed to allocate allocation sites");
+    profiled_bytes = object_heap.allocated_bytes;
+    profile.objects = object_heap.allocated_objects;
+    /* sample a random byte of the first interval, not always the last */
+    profile.next_sample = 1 + (size_t) rand() % allocation_sample_interval;
+}
+
+void charge_allocations(class_file_t *clazz, method_t *method, u4 pc)
+{
+    size_t bytes = object_heap.allocated_bytes - profiled_bytes;
+    size_t objects = object_heap.allocated_objects - profile.objects;
+    profiled_bytes = object_heap.allocated_bytes;
+    profile.objects = object_heap.allocated_objects;
+
+    if (bytes < profile.next_sample) {
+        profile.next_sample -= bytes;
+        return;
+    }
+
+    /* the allocation may cover the sampled byte of several intervals */
+    size_t beyond = bytes - profile.next_sample;
+    size_t samples = 1 + beyond / allocation_sample_interval;
+    profile.next_sample =
+        allocation_sample_interval - beyond % allocation_sample_interval;
+
+    if (2 * (profile.count + 1) > profile.capacity)
+        grow_sites();
+    alloc_site_t *site =
+        find_site_slot(profile.sites, profile.capacity, method, pc);
+    if (!site->clazz) {
+        site->clazz = clazz;
+        site->method = method;
+        site->pc = pc;
+        profile.count++;
+    }
+    double estimate = (double) samples * allocation_sample_interval;
+    site->samples += samples;
+    site->bytes += estimate;
+    site->objects += estimate * objects / bytes;
+    profile.samples += samples;
+}
+
+static const char *instruction_name(alloc_site_t *site)
+{
+    switch (site->method->code.code[site->pc]) {
+    case i_new:
+        return "new";
+    case i_newarray:
+        return "newarray";
+    case i_anewarray:
+        return "anewarray";
+    case i_multianewarray:
+        return "multianewarray";
+    case i_ldc:
+        return "ldc";
+    case i_invokedynamic:
+        return "invokedynamic";
+    case i_invokestatic:
+        return "invokestatic";
+    case i_invokevirtual:
+        return "invokevirtual";
+    default:
+        return "unknown";
+    }
+}
+
+static char *site_class_name(alloc_site_t *site)
+{
+    return find_class_name_from_index(site->clazz->this_class, site->clazz);
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+    const alloc_site_t *x = *(alloc_site_t **) a, *y = *(alloc_site_t **) b;
+    if (x->bytes != y->bytes)
+        return x->bytes < y->bytes ? 1 : -1;
+    return x->objects < y->objects ? 1 : x->objects > y->objects ? -1 : 0;
+}
+
+static void write_json_string(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(file, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+static void write_json(alloc_site_t **sites)
+{
+    FILE *file = fopen(allocation_profile_path, "w");
+    if (!file) {
+        fprintf(stderr, "Unable to create %s\n", allocation_profile_path);
+        return;
+    }
+    fprintf(file, "{\"interval\":%zu,\"samples\":%zu,\"sites\":[",
+            allocation_sample_interval, profile.samples);
+    for (size_t i = 0; i < profile.count; i++) {
+        alloc_site_t *site = sites[i];
+        fprintf(file, "%s\n{\"class\":", i ? "," : "");
+        write_json_string(file, site_class_name(site));
+        fprintf(file, ",\"method\":");
+        write_json_string(file, site->method->name);
+        fprintf(file, ",\"descriptor\":");
+        write_json_string(file, site->method->descriptor);
+        fprintf(file,
+                ",\"pc\":%u,\"instruction\":\"%s\",\"samples\":%zu,"
+                "\"bytes\":%.0f,\"objects\":%.0f}",
+                site->pc, instruction_name(site), site->samples, site->bytes,
+                site->objects);
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file))
+        fprintf(stderr, "Unable to write %s\n", allocation_profile_path);
+}
+
+/* list the sites that allocated the most on standard error */
+static void write_text(alloc_site_t **sites)
+{
+    double total = (double) profile.samples * allocation_sample_interval;
+    fprintf(stderr, "Allocation profile, one sample every %zu bytes:\n",
+            allocation_sample_interval);
+    fprintf(stderr, "%14s %6s %12s  site\n", "bytes", "%", "objects");
+    for (size_t i = 0; i < profile.count && i < ALLOCATION_PROFILE_TOP; i++) {
+        alloc_site_t *site = sites[i];
+        fprintf(stderr, "%14.0f %5.1f%% %12.0f  %s.%s%s @ %u (%s)\n",
+                site->bytes, 100 * site->bytes / total, site->objects,
+                site_class_name(site), site->method->name,
+                site->method->descriptor, site->pc, instruction_name(site));
+    }
+    if (profile.count > ALLOCATION_PROFILE_TOP)
+        fprintf(stderr, "%zu more sites\n",
+                profile.count - ALLOCATION_PROFILE_TOP);
+}
+
+/* called once main returns, while classes are still loaded */
+void report_allocation_profile()
+{
+    if (!allocation_profiling)
+        return;
+    alloc_site_t **sites = malloc(profile.count * sizeof(alloc_site_t *) + 1);
+    assert(sites && "Failed to allocate allocation sites");
+    size_t count = 0;
+    for (size_t i = 0; i < profile.capacity; i++)
+        if (profile.sites[i].clazz)
+            sites[count++] = &profile.sites[i];
+    qsort(sites, count, sizeof(alloc_site_t *), compare_sites);
+
+    write_text(sites);
+    if (allocation_profile_path)
+        write_json(sites);
+    free(sites);
+}
+
+void free_allocation_profile()
+{
+    free(profile.sites);
+    profile.sites = NULL;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "java_file.h"
+#include "object_heap.h"
+
+/* default -XX:AllocationSampleInterval */
+#define ALLOCATION_SAMPLE_INTERVAL ((size_t) 64 * 1024)
+/* sites listed by the report on standard error */
+#define ALLOCATION_PROFILE_TOP 20
+
+/* -XX:+ProfileAllocations, or -XX:AllocationProfilePath */
+extern bool allocation_profiling;
+/* -XX:AllocationSampleInterval, in bytes */
+extern size_t allocation_sample_interval;
+/* -XX:AllocationProfilePath, where the JSON report goes when not NULL */
+extern char *allocation_profile_path;
+
+/* heap counters up to which allocations were charged to a site */
+extern size_t profiled_bytes;
+
+void init_allocation_profile();
+void charge_allocations(class_file_t *clazz, method_t *method, u4 pc);
+void report_allocation_profile();
+void free_allocation_profile();
+
+/**
+ * Charge what was allocated since the last call to the instruction at pc,
+ * which allocated it. Called after every instruction that may allocate, and
+ * only costs a test unless profiling.
+ */
+static inline void profile_allocations(class_file_t *clazz,
+                                       method_t *method,
+                                       u4 pc)
+{
+    if (allocation_profiling && object_heap.allocated_bytes != profiled_bytes)
+        charge_allocations(clazz, method, pc);
+}
@@ -1,4 +1,7 @@
 #include "class_heap.h"
+#include "native.h"
+
+class_heap_t class_heap;
 
 void init_class_heap()
 {
@@ -17,6 +20,7 @@ void add_class(class_file_t *clazz, char *name)
     meta_class->name = malloc(sizeof(char) * (strlen(name) + 1 - 6));
     strncpy(meta_class->name, name, strlen(name) - 6);
     meta_class->name[strlen(name) - 6] = '\0';
+    bind_native_methods(clazz, meta_class->name);
     class_heap.class_info[class_heap.length++] = meta_class;
 }
 
@@ -73,6 +77,8 @@ void free_class_heap()
              j <
              class_heap.class_info[i]->clazz->constant_pool.constant_pool_count;
              j++, constant++) {
+            if (constant->tag == CONSTANT_InvokeDynamic && constant->info)
+                free(((CONSTANT_InvokeDynamic_info *) constant->info)->recipe);
             free(constant->info);
         }
         free(class_heap.class_info[i]->clazz->constant_pool.constant_pool);
@@ -84,8 +90,11 @@ void free_class_heap()
         free(class_heap.class_info[i]->clazz->fields);
 
         for (method_t *method = class_heap.class_info[i]->clazz->methods;
-             method->name; method++)
+             method->name; method++) {
             free(method->code.code);
+            free(method->code.line_numbers);
+            free(method->escape);
+        }
         free(class_heap.class_info[i]->clazz->methods);
 
         free(class_heap.class_info[i]->clazz->interfaces);
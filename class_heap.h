@@ -10,7 +10,7 @@ typedef struct {
     meta_class_t **class_info;
 } class_heap_t;
 
-class_heap_t class_heap;
+extern class_heap_t class_heap;
 
 void init_class_heap();
 void free_class_heap();
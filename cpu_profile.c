@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE /* SA_RESTART, setitimer() */
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cpu_profile.h"
+#include "java_file.h"
+#include "stack.h"
+
+bool cpu_profiling = false;
+int cpu_sample_rate = CPU_SAMPLE_RATE;
+char *cpu_profile_path = NULL;
+
+/**
+ * Sampling CPU profiler. A SIGPROF timer interrupts the program every
+ * 1 / cpu_sample_rate second of CPU time, and the signal handler walks the
+ * chain of frames from current_frame, each of which tells the method it
+ * runs and the pc of its current instruction.
+ *
+ * The handler must be async-signal-safe, so samples are counted in a
+ * calling context tree whose nodes are taken from an array allocated
+ * beforehand: a node stands for a stack, the child of the node of the stack
+ * with its innermost frame removed. Frames are told apart by method and
+ * source line, found from the pc through the LineNumberTable. Once the array
+ * is full, new stacks are counted in the node of their longest known prefix.
+ *
+ * When the program ends the stacks sampled are written in the folded format
+ * of flamegraph.pl, one line per stack, its frames from the outermost one
+ * separated by semicolons, followed by the number of samples. Frames are
+ * named after the class and method, and the line when the method has a
+ * LineNumberTable.
+ */
+
+typedef struct {
+    method_t *method; /* NULL for the root and for deeper frames left out */
+    class_file_t *clazz;
+    u2 line; /* 0 when unknown */
+    u4 parent;
+    u4 child; /* first child, 0 for none as the root is no one's child */
+    u4 sibling;
+    u8 samples; /* taken with this stack */
+} call_node_t;
+
+static struct {
+    call_node_t *nodes; /* the root is the first one */
+    u4 count;
+    u8 samples;
+    u8 lost; /* for lack of nodes */
+} profile;
+
+/* find the child of a node for a frame, adding it when there is none, or
+ * the node itself when no node is left */
+static u4 child_node(u4 node, method_t *method, class_file_t *clazz, u2 line)
+{
+    u4 child = profile.nodes[node].child;
+    for (; child; child = profile.nodes[child].sibling) {
+        call_node_t *candidate = &profile.nodes[child];
+        if (candidate->method == method && candidate->line == line &&
+            candidate->clazz == clazz)
+            return child;
+    }
+    if (profile.count == CPU_PROFILE_NODES)
+        return node;
+
+    child = profile.count++;
+    call_node_t *new_node = &profile.nodes[child];
+    new_node->method = method;
+    new_node->clazz = clazz;
+    new_node->line = line;
+    new_node->parent = node;
+    new_node->child = 0;
+    new_node->sibling = profile.nodes[node].child;
+    new_node->samples = 0;
+    profile.nodes[node].child = child;
+    return child;
+}
+
+static void take_sample(int sig)
+{
+    (void) sig;
+    frame_t *frames[CPU_PROFILE_MAX_DEPTH];
+    int depth = 0;
+    frame_t *frame = current_frame;
+    for (; frame && depth < CPU_PROFILE_MAX_DEPTH; frame = frame->prev)
+        frames[depth++] = frame;
+    if (!depth)
+        return; /* no Java code running */
+
+    u4 node = 0;
+    if (frame) /* too deep, the outermost frames are left out */
+        node = child_node(node, NULL, NULL, 0);
+    while (depth--) {
+        frame_t *sampled = frames[depth];
+        u4 child =
+            child_node(node, sampled->method, sampled->clazz,
+                       line_number_of(&sampled->method->code, sampled->pc));
+        if (child == node) {
+            profile.lost++;
+            break;
+        }
+        node = child;
+    }
+    profile.nodes[node].samples++;
+    profile.samples++;
+}
+
+/* start sampling, before any Java code runs */
+void start_cpu_profile()
+{
+    if (!cpu_profiling)
+        return;
+    profile.nodes = calloc(CPU_PROFILE_NODES, sizeof(call_node_t));
+    assert(profile.nodes && "Failed to allocate profile");
+    profile.count = 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, NULL);
+
+    long interval = 1000000 / cpu_sample_rate;
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = interval / 1000000,
+                        .tv_usec = interval % 1000000},
+        .it_value = {.tv_sec = interval / 1000000,
+                     .tv_usec = interval % 1000000},
+    };
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+static void write_frame(FILE *file, call_node_t *node)
+{
+    if (!node->method) {
+        fputs("[deeper frames]", file);
+        return;
+    }
+    fprintf(file, "%s.%s",
+            find_class_name_from_index(node->clazz->this_class, node->clazz),
+            node->method->name);
+    if (node->line)
+        fprintf(file, ":%u", node->line);
+}
+
+static void write_folded(FILE *file)
+{
+    u4 stack[CPU_PROFILE_MAX_DEPTH + 1];
+    for (u4 i = 1; i < profile.count; i++) {
+        if (!profile.nodes[i].samples)
+            continue;
+        int depth = 0;
+        for (u4 node = i; node; node = profile.nodes[node].parent)
+            stack[depth++] = node;
+        while (depth--) {
+            write_frame(file, &profile.nodes[stack[depth]]);
+            fputc(depth ? ';' : ' ', file);
+        }
+        fprintf(file, "%llu\n", (unsigned long long) profile.nodes[i].samples);
+    }
+}
+
+/* stop sampling once main returns, and write the stacks sampled */
+void stop_cpu_profile()
+{
+    if (!cpu_profiling)
+        return;
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+
+    char default_path[32];
+    snprintf(default_path, sizeof(default_path), "java_pid%ld.folded",
+             (long) getpid());
+    const char *path = cpu_profile_path ? cpu_profile_path : default_path;
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Unable to create %s\n", path);
+        return;
+    }
+    write_folded(file);
+    if (fclose(file)) {
+        fprintf(stderr, "Unable to write %s\n", path);
+        return;
+    }
+    fprintf(stderr, "CPU profile written to %s, %llu samples", path,
+            (unsigned long long) profile.samples);
+    if (profile.lost)
+        fprintf(stderr, ", %llu of them cut short for lack of nodes",
+                (unsigned long long) profile.lost);
+    fputc('\n', stderr);
+}
+
+void free_cpu_profile()
+{
+    free(profile.nodes);
+    profile.nodes = NULL;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* default -XX:CPUSampleRate, in samples per second of CPU time */
+#define CPU_SAMPLE_RATE 1000
+/* innermost frames of a stack kept by a sample */
+#define CPU_PROFILE_MAX_DEPTH 256
+/* distinct stacks, counting their prefixes, a profile can tell apart */
+#define CPU_PROFILE_NODES (64 * 1024)
+
+/* -XX:+ProfileCPU, or -XX:CPUProfilePath */
+extern bool cpu_profiling;
+/* -XX:CPUSampleRate */
+extern int cpu_sample_rate;
+/* -XX:CPUProfilePath, java_pid<pid>.folded when NULL */
+extern char *cpu_profile_path;
+
+void start_cpu_profile();
+void stop_cpu_profile();
+void free_cpu_profile();
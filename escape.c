@@ -0,0 +1,860 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "class_heap.h"
+#include "escape.h"
+
+bool escape_analysis = true;
+
+/* class path of the program, see jvm.c */
+extern char *prefix;
+
+/**
+ * Intraprocedural escape analysis. The bytecode of a method is abstractly
+ * interpreted, the value of every local and operand stack entry being the
+ * set of tracked objects it may refer to, one bit each: the objects of the
+ * allocation sites of the method, or its parameters when summarizing it for
+ * its callers. A tracked object escapes when it may be returned, stored in
+ * a field, a static or an array, or passed to a method that lets the
+ * parameter escape in turn. Calls are bound statically by the interpreter,
+ * so the summary of the callee named by the instruction is the one that
+ * applies.
+ *
+ * The objects of a site that does not escape are allocated in the frame of
+ * the method, in one block the site reuses every time it runs. This is only
+ * right when the object of the previous run is dead by then, so a site also
+ * escapes when its object may still be on the operand stack or in a live
+ * local when the site runs again.
+ */
+
+#define MAX_TRACKED 64
+
+/* abstract value of a local or operand stack entry */
+typedef struct {
+    u8 objects; /* tracked objects it may refer to */
+    bool wide;  /* a long, which dup2 duplicates alone */
+} abstract_value_t;
+
+typedef struct {
+    method_t *method;
+    class_file_t *clazz;
+    u1 *code;
+    u4 length;
+    int count;      /* instructions */
+    int *index_of;  /* instruction starting at a pc, -1 in between */
+    u4 *pcs;        /* pc of every instruction */
+    int *succ_from; /* successors of instruction i are succs[succ_from[i]..] */
+    int *succs;
+    u8 *live; /* locals live before every instruction */
+    int width;  /* entries of a state, locals then operand stack */
+    abstract_value_t *states;
+    int *depths; /* operand stack depth of every state, -1 until reached */
+    u8 escaped;
+} analysis_t;
+
+static inline int32_t read_s4(const u1 *p)
+{
+    return (int32_t) ((u4) p[0] << 24 | (u4) p[1] << 16 | (u4) p[2] << 8 |
+                      p[3]);
+}
+
+static inline int16_t read_s2(const u1 *p)
+{
+    return (int16_t) (p[0] << 8 | p[1]);
+}
+
+/* bytes of the instruction at pc, 0 for one the interpreter does not run */
+static u4 instruction_length(const u1 *code, u4 length, u4 pc)
+{
+    u1 opcode = code[pc];
+    switch (opcode) {
+    case i_bipush:
+    case i_ldc:
+    case i_iload:
+    case i_lload:
+    case i_aload:
+    case i_istore:
+    case i_lstore:
+    case i_astore:
+    case i_newarray:
+        return 2;
+    case i_sipush:
+    case i_ldc2_w:
+    case i_iinc:
+    case i_ifeq:
+    case i_ifne:
+    case i_iflt:
+    case i_ifge:
+    case i_ifgt:
+    case i_ifle:
+    case i_if_icmpeq:
+    case i_if_icmpne:
+    case i_if_icmplt:
+    case i_if_icmpge:
+    case i_if_icmpgt:
+    case i_if_icmple:
+    case i_goto:
+    case i_getstatic:
+    case i_putstatic:
+    case i_getfield:
+    case i_putfield:
+    case i_invokevirtual:
+    case i_invokespecial:
+    case i_invokestatic:
+    case i_new:
+    case i_anewarray:
+    case i_ifnull:
+        return 3;
+    case i_multianewarray:
+        return 4;
+    case i_invokedynamic:
+        return 5;
+    case i_tableswitch: {
+        u4 table = (pc + 4) & ~(u4) 3;
+        if (table + 12 > length)
+            return 0;
+        int32_t low = read_s4(code + table + 4);
+        int32_t high = read_s4(code + table + 8);
+        if (high < low)
+            return 0;
+        return table - pc + 12 + 4 * (u4) (high - low + 1);
+    }
+    default:
+        if ((opcode >= i_aconst_null && opcode <= i_iconst_5) ||
+            (opcode >= i_iload_0 && opcode <= i_saload) ||
+            (opcode >= i_istore_0 && opcode <= i_lstore_3) ||
+            (opcode >= i_astore_0 && opcode <= i_dup2) ||
+            (opcode >= i_iadd && opcode <= i_ineg) ||
+            (opcode >= i_i2l && opcode <= i_lcmp) ||
+            (opcode >= i_ireturn && opcode <= i_return) ||
+            opcode == i_arraylength) {
+            /* the ranges hold a few opcodes the interpreter lacks */
+            switch (opcode) {
+            case 0x6a: /* fmul */
+            case 0x6b: /* dmul */
+            case 0x6e: /* fdiv */
+            case 0x6f: /* ddiv */
+            case 0x71: /* lrem */
+            case 0x72: /* frem */
+            case 0x73: /* drem */
+            case 0x86: /* i2f */
+            case 0x87: /* i2d */
+            case 0x88: /* l2i */
+            case 0x89: /* l2f */
+            case 0x8a: /* l2d */
+            case 0x8b: /* f2i */
+            case 0x8c: /* f2l */
+            case 0x8d: /* f2d */
+            case 0x8e: /* d2i */
+            case 0x8f: /* d2l */
+            case 0x90: /* d2f */
+            case 0x5a: /* dup_x1 */
+            case 0x5b: /* dup_x2 */
+            case 0x58: /* pop2 */
+            case 0x62: /* fadd */
+            case 0x63: /* dadd */
+            case 0x66: /* fsub */
+            case 0x67: /* dsub */
+            case 0xae: /* freturn */
+            case 0xaf: /* dreturn */
+                return 0;
+            default:
+                return 1;
+            }
+        }
+        return 0;
+    }
+}
+
+/* find the instructions and the edges between them, false if the method
+ * cannot be analyzed */
+static bool decode(analysis_t *a)
+{
+    a->index_of = malloc(sizeof(int) * a->length);
+    a->pcs = malloc(sizeof(u4) * a->length);
+    assert(a->index_of && a->pcs && "Failed to allocate analysis");
+    size_t edges = 0;
+    for (u4 pc = 0; pc < a->length;) {
+        u4 length = instruction_length(a->code, a->length, pc);
+        if (!length || pc + length > a->length)
+            return false;
+        a->index_of[pc] = a->count;
+        for (u4 i = 1; i < length; i++)
+            a->index_of[pc + i] = -1;
+        a->pcs[a->count++] = pc;
+        edges += a->code[pc] == i_tableswitch ? (length - 12) / 4 + 1 : 2;
+        pc += length;
+    }
+
+    a->succ_from = malloc(sizeof(int) * (a->count + 1));
+    a->succs = malloc(sizeof(int) * edges);
+    assert(a->succ_from && a->succs && "Failed to allocate analysis");
+    int edge = 0;
+    for (int i = 0; i < a->count; i++) {
+        u4 pc = a->pcs[i];
+        u1 opcode = a->code[pc];
+        a->succ_from[i] = edge;
+        int64_t targets[2];
+        int target_count = 0;
+        if ((opcode >= i_ifeq && opcode <= i_if_icmple) ||
+            opcode == i_ifnull) {
+            targets[target_count++] = pc + 3;
+            targets[target_count++] = (int64_t) pc + read_s2(a->code + pc + 1);
+        } else if (opcode == i_goto) {
+            targets[target_count++] = (int64_t) pc + read_s2(a->code + pc + 1);
+        } else if (opcode == i_tableswitch) {
+            u4 table = (pc + 4) & ~(u4) 3;
+            int32_t low = read_s4(a->code + table + 4);
+            int32_t high = read_s4(a->code + table + 8);
+            for (int64_t k = -1; k <= (int64_t) high - low; k++) {
+                u4 offset = k < 0 ? table : table + 12 + 4 * (u4) k;
+                int64_t target = (int64_t) pc + read_s4(a->code + offset);
+                if (target < 0 || target >= a->length ||
+                    a->index_of[target] < 0)
+                    return false;
+                a->succs[edge++] = a->index_of[target];
+            }
+        } else if (opcode < i_ireturn || opcode > i_return) {
+            targets[target_count++] =
+                pc + instruction_length(a->code, a->length, pc);
+        }
+        for (int k = 0; k < target_count; k++) {
+            /* falling off the end of the code is not allowed either */
+            if (targets[k] < 0 || targets[k] >= a->length ||
+                a->index_of[targets[k]] < 0)
+                return false;
+            a->succs[edge++] = a->index_of[targets[k]];
+        }
+    }
+    a->succ_from[a->count] = edge;
+    return true;
+}
+
+/* local read and written by instruction at pc, -1 for none */
+static void local_access(const u1 *code, u4 pc, int *read, int *written)
+{
+    u1 opcode = code[pc];
+    *read = *written = -1;
+    switch (opcode) {
+    case i_iload:
+    case i_lload:
+    case i_aload:
+        *read = code[pc + 1];
+        break;
+    case i_istore:
+    case i_lstore:
+    case i_astore:
+        *written = code[pc + 1];
+        break;
+    case i_iinc:
+        *read = code[pc + 1];
+        break;
+    default:
+        if (opcode >= i_iload_0 && opcode <= i_iload_3)
+            *read = opcode - i_iload_0;
+        else if (opcode >= i_lload_0 && opcode <= i_lload_3)
+            *read = opcode - i_lload_0;
+        else if (opcode >= i_aload_0 && opcode <= i_aload_3)
+            *read = opcode - i_aload_0;
+        else if (opcode >= i_istore_0 && opcode <= i_istore_3)
+            *written = opcode - i_istore_0;
+        else if (opcode >= i_lstore_0 && opcode <= i_lstore_3)
+            *written = opcode - i_lstore_0;
+        else if (opcode >= i_astore_0 && opcode <= i_astore_3)
+            *written = opcode - i_astore_0;
+        break;
+    }
+}
+
+/* the locals live before every instruction, by backward dataflow */
+static void compute_liveness(analysis_t *a)
+{
+    a->live = calloc(a->count, sizeof(u8));
+    assert(a->live && "Failed to allocate analysis");
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = a->count - 1; i >= 0; i--) {
+            u8 live = 0;
+            for (int e = a->succ_from[i]; e < a->succ_from[i + 1]; e++)
+                live |= a->live[a->succs[e]];
+            int read, written;
+            local_access(a->code, a->pcs[i], &read, &written);
+            if (written >= 0)
+                live &= ~((u8) 1 << written);
+            if (read >= 0)
+                live |= (u8) 1 << read;
+            if (live != a->live[i]) {
+                a->live[i] = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+static class_file_t *find_loaded_class(char *name)
+{
+    class_file_t *clazz = find_class_from_heap(name);
+    if (!clazz) {
+        char *tmp = malloc(strlen(name) + strlen(prefix) + 1);
+        strcpy(tmp, prefix);
+        strcat(tmp, name);
+        clazz = find_class_from_heap(tmp);
+        free(tmp);
+    }
+    return clazz;
+}
+
+/* number of parameters of a method descriptor, this excluded */
+static int count_parameters(const char *descriptor)
+{
+    int count = 0;
+    for (const char *p = descriptor + 1; *p != ')'; p++) {
+        while (*p == '[')
+            p++;
+        if (*p == 'L')
+            p = strchr(p, ';');
+        count++;
+    }
+    return count;
+}
+
+static u8 escaping_params(method_t *method, class_file_t *clazz);
+
+/* pass the arguments of an invoke instruction, which escape with the
+ * parameters of the callee that do */
+static bool invoke(analysis_t *a,
+                   u2 index,
+                   bool has_this,
+                   abstract_value_t *stack,
+                   int *depth)
+{
+    char *name, *descriptor;
+    char *class_name =
+        find_method_info_from_index(index, a->clazz, &name, &descriptor);
+    int argc = count_parameters(descriptor) + has_this;
+    if (*depth < argc)
+        return false;
+    *depth -= argc;
+    abstract_value_t *args = stack + *depth;
+
+    u8 passed = 0;
+    for (int i = 0; i < argc; i++)
+        passed |= args[i].objects;
+    if (passed) {
+        u8 escaping = ~(u8) 0;
+        class_file_t *target_class = find_loaded_class(class_name);
+        method_t *callee =
+            target_class ? find_method(name, descriptor, target_class) : NULL;
+        if (callee)
+            escaping = escaping_params(callee, target_class);
+        for (int i = 0; i < argc; i++) {
+            if (i >= MAX_TRACKED || (escaping >> i & 1))
+                a->escaped |= args[i].objects;
+        }
+    }
+
+    char ret = strchr(descriptor, ')')[1];
+    if (ret != 'V') {
+        stack[*depth] = (abstract_value_t){0, ret == 'J' || ret == 'D'};
+        (*depth)++;
+    }
+    return true;
+}
+
+/**
+ * Apply instruction i to the state of locals and operand stack, recording
+ * what escapes. site_of gives the bit of the objects allocated by a new
+ * instruction, 0 for those not tracked.
+ */
+static bool transfer(analysis_t *a,
+                     int i,
+                     abstract_value_t *locals,
+                     abstract_value_t *stack,
+                     int *depth,
+                     u8 (*site_of)(analysis_t *a, u4 pc))
+{
+    u4 pc = a->pcs[i];
+    const u1 *code = a->code;
+    u1 opcode = code[pc];
+    u2 max_locals = a->method->code.max_locals;
+    u2 max_stack = a->method->code.max_stack;
+    int pops = 0, pushes = 0;
+    bool wide = false;
+
+#define POP(n)                                                               \
+    do {                                                                     \
+        if (*depth < (n))                                                    \
+            return false;                                                    \
+        *depth -= (n);                                                       \
+    } while (0)
+#define PUSH(value)                                                          \
+    do {                                                                     \
+        abstract_value_t pushed = (value);                                   \
+        if (*depth >= max_stack)                                             \
+            return false;                                                    \
+        stack[(*depth)++] = pushed;                                          \
+    } while (0)
+#define ESCAPE(n) (a->escaped |= stack[*depth - (n)].objects)
+
+    switch (opcode) {
+    case i_aload:
+    case i_aload_0:
+    case i_aload_1:
+    case i_aload_2:
+    case i_aload_3: {
+        int local = opcode == i_aload ? code[pc + 1] : opcode - i_aload_0;
+        if (local >= max_locals)
+            return false;
+        PUSH(locals[local]);
+        return true;
+    }
+    case i_astore:
+    case i_astore_0:
+    case i_astore_1:
+    case i_astore_2:
+    case i_astore_3: {
+        int local = opcode == i_astore ? code[pc + 1] : opcode - i_astore_0;
+        if (local >= max_locals)
+            return false;
+        POP(1);
+        locals[local] = stack[*depth];
+        return true;
+    }
+    case i_new: {
+        u8 site = site_of(a, pc);
+        /* the object of the previous run must be dead, as it is reused */
+        for (int k = 0; k < *depth; k++)
+            a->escaped |= stack[k].objects & site;
+        for (int k = 0; k < max_locals && k < MAX_TRACKED; k++) {
+            if (a->live[i] >> k & 1)
+                a->escaped |= locals[k].objects & site;
+        }
+        PUSH(((abstract_value_t){site, false}));
+        return true;
+    }
+    case i_dup:
+        if (*depth < 1)
+            return false;
+        PUSH(stack[*depth - 1]);
+        return true;
+    case i_dup2:
+        if (*depth < 1)
+            return false;
+        if (stack[*depth - 1].wide) {
+            PUSH(stack[*depth - 1]);
+        } else {
+            if (*depth < 2)
+                return false;
+            abstract_value_t first = stack[*depth - 2];
+            abstract_value_t second = stack[*depth - 1];
+            PUSH(first);
+            PUSH(second);
+        }
+        return true;
+    case i_areturn:
+    case i_putstatic:
+        if (*depth < 1)
+            return false;
+        ESCAPE(1);
+        POP(1);
+        return true;
+    case i_putfield:
+        /* stored in an object, whose block may outlive the frame */
+        if (*depth < 2)
+            return false;
+        ESCAPE(1);
+        POP(2);
+        return true;
+    case i_aastore:
+        if (*depth < 3)
+            return false;
+        ESCAPE(1);
+        POP(3);
+        return true;
+    case i_invokedynamic: {
+        /* a string concatenation, whose arguments are not followed */
+        CONSTANT_InvokeDynamic_info *call_site =
+            (CONSTANT_InvokeDynamic_info *) get_constant(
+                &a->clazz->constant_pool, read_s2(code + pc + 1) & 0xffff)
+                ->info;
+        const_pool_info *name_and_type = get_constant(
+            &a->clazz->constant_pool, call_site->name_and_type_index);
+        char *descriptor =
+            (char *) get_constant(
+                &a->clazz->constant_pool,
+                ((CONSTANT_NameAndType_info *) name_and_type->info)
+                    ->descriptor_index)
+                ->info;
+        int argc = count_parameters(descriptor);
+        if (*depth < argc)
+            return false;
+        for (int k = 1; k <= argc; k++)
+            ESCAPE(k);
+        POP(argc);
+        PUSH(((abstract_value_t){0, false}));
+        return true;
+    }
+    case i_invokevirtual:
+    case i_invokespecial:
+        return invoke(a, read_s2(code + pc + 1) & 0xffff, true, stack, depth);
+    case i_invokestatic:
+        return invoke(a, read_s2(code + pc + 1) & 0xffff, false, stack, depth);
+    case i_getfield:
+    case i_getstatic: {
+        char *name, *descriptor;
+        find_field_info_from_index(read_s2(code + pc + 1) & 0xffff, a->clazz,
+                                   &name, &descriptor);
+        pops = opcode == i_getfield;
+        pushes = 1;
+        wide = descriptor[0] == 'J' || descriptor[0] == 'D';
+    } break;
+    case i_multianewarray:
+        pops = code[pc + 3];
+        pushes = 1;
+        break;
+    case i_istore:
+    case i_lstore:
+    case i_istore_0:
+    case i_istore_1:
+    case i_istore_2:
+    case i_istore_3:
+    case i_lstore_0:
+    case i_lstore_1:
+    case i_lstore_2:
+    case i_lstore_3: {
+        int read, written;
+        local_access(code, pc, &read, &written);
+        if (written >= max_locals)
+            return false;
+        locals[written] = (abstract_value_t){0, false};
+        pops = 1;
+    } break;
+    case i_lload:
+    case i_lload_0:
+    case i_lload_1:
+    case i_lload_2:
+    case i_lload_3:
+    case i_ldc2_w:
+    case i_i2l:
+        pops = opcode == i_i2l;
+        pushes = 1;
+        wide = true;
+        break;
+    case i_laload:
+    case i_daload:
+    case i_ladd:
+    case i_lsub:
+    case i_lmul:
+    case i_ldiv:
+        pops = 2;
+        pushes = 1;
+        wide = true;
+        break;
+    case i_iastore:
+    case i_lastore:
+    case i_fastore:
+    case i_dastore:
+    case i_bastore:
+    case i_castore:
+    case i_sastore:
+        pops = 3;
+        break;
+    case i_iaload:
+    case i_faload:
+    case i_aaload:
+    case i_baload:
+    case i_caload:
+    case i_saload:
+    case i_lcmp:
+    case i_if_icmpeq:
+    case i_if_icmpne:
+    case i_if_icmplt:
+    case i_if_icmpge:
+    case i_if_icmpgt:
+    case i_if_icmple:
+        pops = 2;
+        pushes = opcode < i_if_icmpeq;
+        break;
+    case i_iadd:
+    case i_isub:
+    case i_imul:
+    case i_idiv:
+    case i_irem:
+        pops = 2;
+        pushes = 1;
+        break;
+    case i_ineg:
+    case i_i2b:
+    case i_i2c:
+    case i_i2s:
+    case i_newarray:
+    case i_anewarray:
+    case i_arraylength:
+        pops = pushes = 1;
+        break;
+    case i_ifeq:
+    case i_ifne:
+    case i_iflt:
+    case i_ifge:
+    case i_ifgt:
+    case i_ifle:
+    case i_ifnull:
+    case i_tableswitch:
+    case i_pop:
+    case i_ireturn:
+    case i_lreturn:
+        pops = 1;
+        break;
+    case i_iinc:
+    case i_goto:
+    case i_return:
+        break;
+    default:
+        /* constants and int loads */
+        pushes = 1;
+        break;
+    }
+    POP(pops);
+    for (int k = 0; k < pushes; k++)
+        PUSH(((abstract_value_t){0, wide}));
+    return true;
+
+#undef POP
+#undef PUSH
+#undef ESCAPE
+}
+
+/* merge state into the one before instruction i, true if it changed */
+static bool merge(analysis_t *a, int i, abstract_value_t *state, int depth)
+{
+    abstract_value_t *into = a->states + (size_t) i * a->width;
+    u2 max_locals = a->method->code.max_locals;
+    if (a->depths[i] < 0) {
+        a->depths[i] = depth;
+        memcpy(into, state, sizeof(abstract_value_t) * (max_locals + depth));
+        return true;
+    }
+    if (a->depths[i] != depth)
+        return false;
+    bool changed = false;
+    for (int k = 0; k < max_locals + depth; k++) {
+        u8 objects = into[k].objects | state[k].objects;
+        if (objects != into[k].objects) {
+            into[k].objects = objects;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Run the abstract interpretation from the entry state of the locals to a
+ * fixpoint. Returns the tracked objects that may escape, all of them if the
+ * method cannot be analyzed.
+ */
+static u8 analyze(analysis_t *a,
+                  abstract_value_t *entry,
+                  u8 (*site_of)(analysis_t *a, u4 pc))
+{
+    u2 max_locals = a->method->code.max_locals;
+    a->width = max_locals + a->method->code.max_stack;
+    a->states = malloc(sizeof(abstract_value_t) * a->width * a->count + 1);
+    a->depths = malloc(sizeof(int) * a->count);
+    int *worklist = malloc(sizeof(int) * a->count);
+    bool *queued = calloc(a->count, sizeof(bool));
+    abstract_value_t *state = malloc(sizeof(abstract_value_t) * a->width + 1);
+    assert(a->states && a->depths && worklist && queued && state &&
+           "Failed to allocate analysis");
+    for (int i = 0; i < a->count; i++)
+        a->depths[i] = -1;
+
+    bool ok = true;
+    memcpy(a->states, entry, sizeof(abstract_value_t) * max_locals);
+    a->depths[0] = 0;
+    int pending = 0;
+    worklist[pending++] = 0;
+    queued[0] = true;
+    while (ok && pending) {
+        int i = worklist[--pending];
+        queued[i] = false;
+        int depth = a->depths[i];
+        memcpy(state, a->states + (size_t) i * a->width,
+               sizeof(abstract_value_t) * (max_locals + depth));
+        if (!transfer(a, i, state, state + max_locals, &depth, site_of)) {
+            ok = false;
+            break;
+        }
+        for (int e = a->succ_from[i]; e < a->succ_from[i + 1]; e++) {
+            int next = a->succs[e];
+            if (a->depths[next] >= 0 && a->depths[next] != depth) {
+                ok = false;
+                break;
+            }
+            if (merge(a, next, state, depth) && !queued[next]) {
+                queued[next] = true;
+                worklist[pending++] = next;
+            }
+        }
+    }
+
+    free(state);
+    free(queued);
+    free(worklist);
+    free(a->depths);
+    free(a->states);
+    return ok ? a->escaped : ~(u8) 0;
+}
+
+static void free_analysis(analysis_t *a)
+{
+    free(a->live);
+    free(a->succs);
+    free(a->succ_from);
+    free(a->pcs);
+    free(a->index_of);
+}
+
+/* whether the method has bytecode the analysis can follow */
+static bool analyzable(method_t *method)
+{
+    return !(method->access_flag & ACC_NATIVE) && method->code.code &&
+           method->code.code_length && method->code.max_locals <= MAX_TRACKED;
+}
+
+static u8 untracked(analysis_t *a, u4 pc)
+{
+    (void) a;
+    (void) pc;
+    return 0;
+}
+
+/* parameters of method that may escape it, a bit each */
+static u8 escaping_params(method_t *method, class_file_t *clazz)
+{
+    escape_info_t *info = method_escape_info(method);
+    if (info->params_known)
+        return info->escaping_params;
+    /* recursion assumes the worst, which is also what is cached then */
+    if (info->params_running || !analyzable(method))
+        return ~(u8) 0;
+
+    info->params_running = true;
+    analysis_t a = {
+        .method = method,
+        .clazz = clazz,
+        .code = method->code.code,
+        .length = method->code.code_length,
+    };
+    u8 escaping = ~(u8) 0;
+    if (decode(&a)) {
+        /* parameters are in the first locals, one each, this included */
+        int argc = count_parameters(method->descriptor) +
+                   !(method->access_flag & ACC_STATIC);
+        abstract_value_t entry[MAX_TRACKED] = {{0}};
+        for (int i = 0; i < argc && i < method->code.max_locals; i++)
+            entry[i].objects = (u8) 1 << i;
+        a.live = calloc(a.count, sizeof(u8));
+        assert(a.live && "Failed to allocate analysis");
+        escaping = analyze(&a, entry, untracked);
+    }
+    free_analysis(&a);
+    info->params_running = false;
+    info->params_known = true;
+    info->escaping_params = escaping;
+    return escaping;
+}
+
+/* the bit of a site is its index among the sites of the method */
+static u8 site_bit(analysis_t *a, u4 pc)
+{
+    escape_info_t *info = a->method->escape;
+    for (u2 i = 0; i < info->site_count && i < MAX_TRACKED; i++) {
+        if (info->sites[i].pc == pc)
+            return (u8) 1 << i;
+    }
+    return 0;
+}
+
+/* the escape information of a method, with its allocation sites found */
+escape_info_t *method_escape_info(method_t *method)
+{
+    if (method->escape)
+        return method->escape;
+
+    u2 count = 0;
+    const u1 *code = method->code.code;
+    u4 length = code ? method->code.code_length : 0;
+    u4 pc = 0;
+    for (u4 step; pc < length; pc += step) {
+        step = instruction_length(code, length, pc);
+        if (!step)
+            break;
+        count += code[pc] == i_new;
+    }
+    escape_info_t *info =
+        calloc(1, sizeof(escape_info_t) + sizeof(escape_site_t) * count);
+    assert(info && "Failed to allocate escape information");
+    info->site_count = count;
+    count = 0;
+    for (u4 pc = 0, step; pc < length; pc += step) {
+        step = instruction_length(code, length, pc);
+        if (!step)
+            break;
+        if (code[pc] == i_new)
+            info->sites[count++].pc = pc;
+    }
+    /* a method with code the analysis does not know allocates on the heap */
+    if (pc < length) {
+        for (u2 i = 0; i < count; i++)
+            info->sites[i].state = SITE_HEAP;
+    }
+    method->escape = info;
+    return info;
+}
+
+/**
+ * Whether the new instruction at pc allocates in the frame of method, and
+ * the frame slot its object is kept in. The site is analyzed on its first
+ * run, once its class is loaded along with the constructor that receives
+ * its objects.
+ */
+bool allocate_in_frame(method_t *method, class_file_t *clazz, u4 pc, u2 *slot)
+{
+    escape_info_t *info = method_escape_info(method);
+    u2 low = 0, high = info->site_count;
+    while (low < high) {
+        u2 middle = (low + high) / 2;
+        if (info->sites[middle].pc < pc)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    assert(low < info->site_count && info->sites[low].pc == pc &&
+           "new instruction not found");
+    escape_site_t *site = &info->sites[low];
+    *slot = low;
+    if (site->state != SITE_UNDECIDED)
+        return site->state == SITE_FRAME;
+
+    site->state = SITE_HEAP;
+    if (low >= MAX_TRACKED || !analyzable(method))
+        return false;
+    analysis_t a = {
+        .method = method,
+        .clazz = clazz,
+        .code = method->code.code,
+        .length = method->code.code_length,
+    };
+    if (decode(&a)) {
+        compute_liveness(&a);
+        abstract_value_t entry[MAX_TRACKED] = {{0}};
+        u8 escaped = analyze(&a, entry, site_bit);
+        if (!(escaped >> low & 1))
+            site->state = SITE_FRAME;
+    }
+    free_analysis(&a);
+    return site->state == SITE_FRAME;
+}
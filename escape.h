@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "java_file.h"
+
+/* whether new may allocate in the frame, cleared by -XX:-DoEscapeAnalysis */
+extern bool escape_analysis;
+
+/* where the objects of an allocation site go, decided on its first run */
+typedef enum {
+    SITE_UNDECIDED,
+    SITE_HEAP,
+    SITE_FRAME, /* in the frame of the method, reused by every run */
+} site_state_t;
+
+typedef struct {
+    u4 pc; /* of the new instruction */
+    u1 state;
+} escape_site_t;
+
+/**
+ * What escape analysis knows about a method: which of its parameters may
+ * escape it, computed once when it is first called with an object of a
+ * frame, and where its allocation sites put their objects.
+ */
+typedef struct escape_info {
+    u8 escaping_params; /* bit i set when parameter i may escape */
+    bool params_known;
+    bool params_running; /* being analyzed, so assumed to let all escape */
+    u2 site_count;
+    escape_site_t sites[]; /* ordered by pc */
+} escape_info_t;
+
+escape_info_t *method_escape_info(method_t *method);
+bool allocate_in_frame(method_t *method,
+                       class_file_t *clazz,
+                       u4 pc,
+                       u2 *slot);
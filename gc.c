@@ -0,0 +1,730 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "class_heap.h"
+#include "gc.h"
+#include "object_heap.h"
+#include "stack.h"
+#include "trace.h"
+
+bool gc_requested = false;
+bool gc_full = false;
+bool gc_verbose = false;
+int gc_threads = 0;
+
+/**
+ * Generational collector. Young objects are copied out of the nursery to the
+ * old space by minor collections, the old space is collected by a precise
+ * mark-sweep. Roots are the locals, operand stacks and fields of the objects
+ * allocated in every frame, static fields and interned strings, the latter
+ * also keeping alive the strings cached by ldc. Values are only followed when
+ * their type says they are references, so nothing is retained by accident.
+ *
+ * Collections only run at safepoints between instructions, where every live
+ * reference is in a frame, so C code never has to protect references it
+ * holds while allocating, nor expect them to stay in place.
+ *
+ * The old space is marked and swept by gc_threads workers, the thread
+ * running the program being the first of them.
+ */
+
+/* gray objects, whose references are yet to be followed */
+typedef struct {
+    heap_header_t **items;
+    size_t size;
+    size_t capacity;
+} mark_stack_t;
+
+static void push_gray(mark_stack_t *stack, heap_header_t *header)
+{
+    if (stack->size == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items =
+            realloc(stack->items, sizeof(heap_header_t *) * stack->capacity);
+        assert(stack->items && "Failed to grow mark stack");
+    }
+    stack->items[stack->size++] = header;
+}
+
+/**
+ * Each worker marks from a private stack, and moves part of it to a shared
+ * stack whenever the shared one runs empty, so idle workers have something
+ * to steal. Only the shared stack is locked.
+ */
+typedef struct {
+    mark_stack_t local;
+    mark_stack_t shared;
+    pthread_mutex_t lock;
+    size_t freed; /* objects freed by the sweep */
+    size_t live;  /* bytes of the objects left in the regions swept */
+    pointer_list_t holes;
+    pthread_t thread;
+} gc_worker_t;
+
+static gc_worker_t *workers;
+static int worker_count;
+static __thread gc_worker_t *self;
+
+/* workers wait for a job, and the program for them to be done with it */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static void (*pool_job)(gc_worker_t *);
+static unsigned pool_generation;
+static int pool_running;
+
+static void *worker_main(void *arg)
+{
+    self = arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (pool_generation == seen)
+            pthread_cond_wait(&pool_start, &pool_lock);
+        seen = pool_generation;
+        void (*job)(gc_worker_t *) = pool_job;
+        pthread_mutex_unlock(&pool_lock);
+
+        job(self);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_running == 0)
+            pthread_cond_signal(&pool_done);
+    }
+    return NULL;
+}
+
+static void init_workers()
+{
+    if (workers)
+        return;
+    worker_count = gc_threads;
+    if (worker_count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus > 0 ? cpus : 1;
+    }
+    if (worker_count > GC_MAX_THREADS)
+        worker_count = GC_MAX_THREADS;
+
+    workers = calloc(worker_count, sizeof(gc_worker_t));
+    assert(workers && "Failed to allocate collector workers");
+    /* workers inherit the mask, so that the profiler only samples the
+     * thread running the program, see cpu_profile.c */
+    sigset_t profiling, mask;
+    sigemptyset(&profiling);
+    sigaddset(&profiling, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profiling, &mask);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        if (i == 0)
+            continue;
+        int error = pthread_create(&workers[i].thread, NULL, worker_main,
+                                   &workers[i]);
+        assert(!error && "Failed to start collector worker");
+        (void) error;
+    }
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    self = &workers[0];
+}
+
+/* run job on every worker, and wait for all of them to finish */
+static void run_workers(void (*job)(gc_worker_t *))
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_job = job;
+    pool_running = worker_count - 1;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    job(&workers[0]);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_running)
+        pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* entries a worker keeps to itself before sharing */
+#define MARK_SHARE_SIZE 64
+
+static void mark(void **slot)
+{
+    if (!*slot)
+        return;
+    heap_header_t *header = block_of(*slot);
+    /* not swept, its fields are roots instead */
+    if (header->flags & HEAP_FRAME)
+        return;
+    if (__atomic_load_n(&header->marked, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&header->marked, true, __ATOMIC_RELAXED))
+        return;
+
+    gc_worker_t *worker = self;
+    push_gray(&worker->local, header);
+    if (worker->local.size >= MARK_SHARE_SIZE &&
+        !__atomic_load_n(&worker->shared.size, __ATOMIC_RELAXED)) {
+        /* share the oldest half, the objects nearest to the roots */
+        size_t half = worker->local.size / 2;
+        mark_stack_t *shared = &worker->shared;
+        pthread_mutex_lock(&worker->lock);
+        if (shared->capacity < shared->size + half) {
+            shared->capacity = shared->size + half;
+            shared->items = realloc(shared->items,
+                                    sizeof(heap_header_t *) * shared->capacity);
+            assert(shared->items && "Failed to grow mark stack");
+        }
+        memcpy(shared->items + shared->size, worker->local.items,
+               sizeof(heap_header_t *) * half);
+        /* the size is peeked at by idle workers without locking */
+        __atomic_store_n(&shared->size, shared->size + half, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&worker->lock);
+        memmove(worker->local.items, worker->local.items + half,
+                sizeof(heap_header_t *) * (worker->local.size - half));
+        worker->local.size -= half;
+    }
+}
+
+/* move up to half of the shared stack of victim to the local one of worker */
+static bool steal(gc_worker_t *worker, gc_worker_t *victim)
+{
+    if (!__atomic_load_n(&victim->shared.size, __ATOMIC_RELAXED))
+        return false;
+    pthread_mutex_lock(&victim->lock);
+    size_t size = victim->shared.size;
+    size_t count = (size + 1) / 2;
+    for (size_t i = 0; i < count; i++)
+        push_gray(&worker->local, victim->shared.items[size - 1 - i]);
+    __atomic_store_n(&victim->shared.size, size - count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->lock);
+    return count > 0;
+}
+
+static bool steal_any(gc_worker_t *worker)
+{
+    int index = worker - workers;
+    for (int i = 1; i <= worker_count; i++) {
+        if (steal(worker, &workers[(index + i) % worker_count]))
+            return true;
+    }
+    return false;
+}
+
+static bool work_left()
+{
+    for (int i = 0; i < worker_count; i++) {
+        if (__atomic_load_n(&workers[i].shared.size, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+/* workers with nothing left to mark or steal */
+static int idle_workers;
+
+/* objects copied out of the nursery by the running minor collection */
+static size_t promoted;
+/* promoted objects, whose references are yet to be evacuated */
+static mark_stack_t gray;
+
+/**
+ * Copy the young block slot refers into to the old space, unless already
+ * done, and update slot to the copy. The young block is left forwarded to
+ * its copy for the other references to it.
+ */
+static void evacuate(void **slot)
+{
+    if (!is_young(*slot))
+        return;
+    heap_header_t *header = block_of(*slot);
+    size_t offset = (char *) *slot - (char *) header;
+    if (header->kind == OBJECT_FORWARDED) {
+        *slot = (char *) (uintptr_t) header->size + offset;
+        return;
+    }
+
+    heap_header_t *copy = alloc_old(header->size);
+    memcpy(copy, header, header->size);
+    if (copy->kind == OBJECT_INSTANCE) {
+        /* the fields follow the object, wherever it is */
+        object_t *obj = (object_t *) (copy + 1);
+        if (obj->ptr)
+            obj->ptr = (variable_t *) (obj + 1);
+    }
+    header->kind = OBJECT_FORWARDED;
+    header->size = (uintptr_t) copy;
+    *slot = (char *) copy + offset;
+    promoted++;
+    push_gray(&gray, copy);
+}
+
+static inline bool is_reference(variable_type_t type)
+{
+    return type == VAR_PTR || type == VAR_STR_PTR || type == VAR_ARRAY_PTR ||
+           type == VAR_MULTARRAY_PTR;
+}
+
+/* call visit on every reference slot of the object */
+static void visit_object(heap_header_t *header, void (*visit)(void **slot))
+{
+    switch (header->kind) {
+    case OBJECT_INSTANCE: {
+        object_t *obj = (object_t *) (header + 1);
+        for (size_t i = 0; i < obj->field_count; i++) {
+            if (is_reference(obj->ptr[i].type))
+                visit(&obj->ptr[i].value.ptr_value);
+        }
+    } break;
+    case OBJECT_REF_ARRAY: {
+        ref_t *elements = (ref_t *) (header + 1);
+        for (u4 i = 0; i < header->length; i++) {
+#ifdef COMPRESSED_REFS
+            if (!elements[i])
+                continue;
+            void *ref = decode_ref(elements[i]);
+            visit(&ref);
+            elements[i] = encode_ref(ref);
+#else
+            visit(&elements[i]);
+#endif
+        }
+    } break;
+    case OBJECT_MULTIARRAY: {
+        char *end = (char *) header + header->size;
+        for (char *p = (char *) (header + 1); p < end;) {
+            heap_header_t *array = (heap_header_t *) p;
+            if (array->kind == OBJECT_ARRAY) {
+                p += array_block_size(array->length,
+                                      array_element_size(array->type));
+                continue;
+            }
+            visit_object(array, visit);
+            p += array_block_size(array->length, sizeof(ref_t));
+        }
+    } break;
+    default:
+        break;
+    }
+}
+
+static void visit_entries(stack_entry_t *entries,
+                          size_t count,
+                          void (*visit)(void **slot))
+{
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].type == STACK_ENTRY_REF)
+            visit(&entries[i].entry.ptr_value);
+    }
+}
+
+static void visit_frames(void (*visit)(void **slot))
+{
+    for (frame_t *frame = current_frame; frame; frame = frame->prev) {
+        visit_entries(frame->locals, frame->max_locals, visit);
+        if (frame->op_stack)
+            visit_entries(frame->op_stack->store, frame->op_stack->size,
+                          visit);
+        for (u2 i = 0; i < frame->frame_object_count; i++) {
+            if (frame->frame_objects[i])
+                visit_object(frame->frame_objects[i], visit);
+        }
+    }
+}
+
+static void visit_statics(void (*visit)(void **slot))
+{
+    for (int i = 0; i < class_heap.length; i++) {
+        class_file_t *clazz = class_heap.class_info[i]->clazz;
+        for (u2 j = 0; j < clazz->fields_count; j++) {
+            variable_t *value = clazz->fields[j].value;
+            if (is_reference(value->type))
+                visit(&value->value.ptr_value);
+        }
+    }
+}
+
+/* the strings cached by ldc, which are interned */
+static void visit_string_constants(void (*visit)(void **slot))
+{
+    for (int i = 0; i < class_heap.length; i++) {
+        constant_pool_t *pool = &class_heap.class_info[i]->clazz->constant_pool;
+        for (u2 j = 0; j < pool->constant_pool_count; j++) {
+            const_pool_info *constant = &pool->constant_pool[j];
+            if (constant->tag == CONSTANT_String)
+                visit(&((CONSTANT_String_info *) constant->info)->resolved);
+        }
+    }
+}
+
+/**
+ * Mark everything reachable from the gray objects of all workers. Marking
+ * is over once every worker is idle at the same time, as only a worker with
+ * gray objects can gray more.
+ */
+static void mark_job(gc_worker_t *worker)
+{
+    u8 start = trace_now();
+    for (;;) {
+        while (worker->local.size)
+            visit_object(worker->local.items[--worker->local.size], mark);
+        if (steal_any(worker))
+            continue;
+
+        __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) ==
+                worker_count) {
+                trace_span("gc", "mark", NULL, start);
+                return;
+            }
+            if (work_left()) {
+                __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/* gray the roots, on the first worker, for the others to steal from */
+static void mark_roots()
+{
+    visit_frames(mark);
+    visit_statics(mark);
+    visit_interned_strings(mark);
+}
+
+/* evacuate the young objects referred to from the objects of a dirty card */
+static void scan_card(u1 *card)
+{
+    region_t *region = REGION_OF(card);
+    size_t index = card - region->cards;
+    char *p = (char *) region + region->starts[index];
+    if (p < REGION_OBJECTS(region))
+        p = REGION_OBJECTS(region);
+    char *card_end = (char *) region + (index + 1) * CARD_SIZE;
+    while (p < card_end) {
+        heap_header_t *header = (heap_header_t *) p;
+        p += header->size;
+        if (header->kind != OBJECT_DEAD)
+            visit_object(header, evacuate);
+    }
+    *card = 0;
+}
+
+/**
+ * Minor collection: copy the young objects reachable from the roots and from
+ * the remembered old-to-young references to the old space, then empty the
+ * nursery. The work is proportional to the live young objects, the old
+ * space is only looked at through the dirty cards.
+ */
+static void collect_nursery()
+{
+    u8 start = trace_now();
+    promoted = 0;
+    visit_frames(evacuate);
+    if (object_heap.young_statics)
+        visit_statics(evacuate);
+    if (object_heap.young_interned) {
+        /* interned by String.intern(), and maybe cached by ldc since */
+        visit_interned_strings(evacuate);
+        visit_string_constants(evacuate);
+    }
+    for (size_t i = 0; i < object_heap.dirty_cards.length; i++)
+        scan_card(object_heap.dirty_cards.items[i]);
+    for (size_t i = 0; i < object_heap.remembered.length; i++) {
+        heap_header_t *header = object_heap.remembered.items[i];
+        header->flags &= ~HEAP_REMEMBERED;
+        visit_object(header, evacuate);
+    }
+    while (gray.size)
+        visit_object(gray.items[--gray.size], evacuate);
+
+    /* nothing refers to the nursery anymore */
+    object_heap.dirty_cards.length = 0;
+    object_heap.remembered.length = 0;
+    object_heap.young_statics = false;
+    object_heap.young_interned = false;
+    memset(object_heap.nursery, 0,
+           object_heap.young_top - object_heap.nursery);
+    object_heap.young_top = object_heap.nursery;
+    trace_span("gc", "young collection", NULL, start);
+}
+
+/* regions being swept, claimed by the workers one at a time */
+static region_t **sweep_regions;
+static bool *sweep_live;
+static size_t sweep_count;
+static size_t sweep_next;
+
+/* make the zeroed space from start to end of a region a single dead block,
+ * which card walks start from, and a hole if it is large enough */
+static void free_space(gc_worker_t *worker,
+                       region_t *region,
+                       char *start,
+                       char *end)
+{
+    heap_header_t *header = (heap_header_t *) start;
+    header->size = end - start;
+    header->kind = OBJECT_DEAD;
+    u4 offset = start - (char *) region;
+    for (u4 card = (offset + CARD_SIZE - 1) / CARD_SIZE;
+         card * CARD_SIZE < (u4) (end - (char *) region); card++)
+        region->starts[card] = offset;
+    if (header->size >= MIN_HOLE_SIZE)
+        pointer_list_push(&worker->holes, header);
+}
+
+/**
+ * Sweep the claimed regions. A region left without marked objects is freed
+ * as a whole afterwards, otherwise the unmarked objects are zeroed and each
+ * run of them and of dead blocks becomes a single dead block, to be
+ * allocated from again.
+ */
+static void sweep_job(gc_worker_t *worker)
+{
+    u8 start = trace_now();
+    worker->freed = 0;
+    worker->live = 0;
+    worker->holes.length = 0;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&sweep_next, 1, __ATOMIC_RELAXED);
+        if (i >= sweep_count) {
+            trace_span("gc", "sweep", NULL, start);
+            return;
+        }
+        region_t *region = sweep_regions[i];
+        size_t live = 0;
+        for (char *p = REGION_OBJECTS(region); p < region->end;) {
+            heap_header_t *header = (heap_header_t *) p;
+            p += header->size;
+            if (header->kind == OBJECT_DEAD)
+                continue;
+            if (header->marked)
+                live += header->size;
+            else
+                worker->freed++;
+        }
+        sweep_live[i] = live > 0;
+        if (!live)
+            continue;
+        worker->live += live;
+
+        char *run = NULL; /* start of the free space being merged */
+        for (char *p = REGION_OBJECTS(region); p < region->end;) {
+            heap_header_t *header = (heap_header_t *) p;
+            size_t size = header->size;
+            if (header->kind != OBJECT_DEAD && header->marked) {
+                header->marked = false;
+                if (run)
+                    free_space(worker, region, run, p);
+                run = NULL;
+            } else {
+                /* dead blocks are zero past their header already */
+                memset(header, 0,
+                       header->kind == OBJECT_DEAD ? sizeof(heap_header_t)
+                                                   : size);
+                if (!run)
+                    run = p;
+            }
+            p += size;
+        }
+        if (run)
+            free_space(worker, region, run, region->end);
+    }
+}
+
+/**
+ * Free unmarked objects. Regions are swept in parallel, then those left
+ * without live objects are freed as a whole, and the free space of the
+ * others is what the old space allocates from first. Large objects are
+ * freed on their own and removed from the object list.
+ */
+static size_t sweep()
+{
+    sweep_count = 0;
+    for (region_t *region = object_heap.regions; region; region = region->next)
+        sweep_count++;
+    sweep_regions = realloc(sweep_regions, sizeof(region_t *) * sweep_count);
+    sweep_live = realloc(sweep_live, sizeof(bool) * sweep_count);
+    assert((sweep_regions && sweep_live) || !sweep_count);
+    size_t count = 0;
+    for (region_t *region = object_heap.regions; region; region = region->next)
+        sweep_regions[count++] = region;
+    sweep_next = 0;
+    run_workers(sweep_job);
+
+    size_t freed = 0;
+    object_heap.bytes = 0;
+    object_heap.holes.length = 0;
+    object_heap.next_hole = 0;
+    for (int i = 0; i < worker_count; i++) {
+        freed += workers[i].freed;
+        object_heap.bytes += workers[i].live;
+        for (size_t j = 0; j < workers[i].holes.length; j++)
+            pointer_list_push(&object_heap.holes, workers[i].holes.items[j]);
+    }
+
+    /* link the regions left, in the same order */
+    region_t **link = &object_heap.regions;
+    for (size_t i = 0; i < sweep_count; i++) {
+        if (!sweep_live[i]) {
+            free_region(sweep_regions[i]);
+            continue;
+        }
+        *link = sweep_regions[i];
+        link = &sweep_regions[i]->next;
+    }
+    *link = NULL;
+
+    size_t live = 0;
+    for (size_t i = 0; i < object_heap.length; i++) {
+        heap_header_t *header = object_heap.objects[i];
+        if (!header->marked) {
+            free_large_object(header);
+            freed++;
+            continue;
+        }
+        header->marked = false;
+        object_heap.bytes += header->size;
+        object_heap.objects[live++] = header;
+    }
+    object_heap.length = live;
+    return freed;
+}
+
+
+static long elapsed_us(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000L +
+           (to->tv_usec - from->tv_usec);
+}
+
+/* pause time of each phase of the last major collection */
+static long roots_us, mark_us, sweep_us;
+
+/* mark-sweep of the old space, which holds every object after a minor
+ * collection */
+static size_t collect_old()
+{
+    struct timeval start, roots_end, mark_end, end;
+    init_workers();
+    u8 trace_start = trace_now();
+    gettimeofday(&start, NULL);
+    /* the free space allocated from is swept too */
+    retire_region();
+    mark_roots();
+    trace_span("gc", "roots", NULL, trace_start);
+    gettimeofday(&roots_end, NULL);
+
+    idle_workers = 0;
+    run_workers(mark_job);
+    gettimeofday(&mark_end, NULL);
+
+    size_t freed = sweep();
+    gettimeofday(&end, NULL);
+    roots_us = elapsed_us(&start, &roots_end);
+    mark_us = elapsed_us(&roots_end, &mark_end);
+    sweep_us = elapsed_us(&mark_end, &end);
+    trace_span("gc", "old collection", NULL, trace_start);
+
+    /* let the heap grow to twice the live data before collecting again */
+    object_heap.threshold = object_heap.bytes * 2;
+    if (object_heap.threshold < GC_INITIAL_THRESHOLD)
+        object_heap.threshold = GC_INITIAL_THRESHOLD;
+    if (object_heap.threshold > object_heap.max_bytes)
+        object_heap.threshold = object_heap.max_bytes;
+    return freed;
+}
+
+void collect_garbage()
+{
+    struct timeval start, minor_end, end;
+    size_t young = object_heap.young_top - object_heap.nursery;
+    size_t before = object_heap.bytes;
+    u8 trace_start = trace_now();
+    gettimeofday(&start, NULL);
+
+    collect_nursery();
+    gettimeofday(&minor_end, NULL);
+    size_t after_minor = object_heap.bytes;
+
+    bool major = gc_full || object_heap.bytes > object_heap.threshold;
+    size_t freed = major ? collect_old() : 0;
+    gc_requested = gc_full = false;
+
+    if (object_heap.bytes > object_heap.max_bytes) {
+        fprintf(stderr, "Exception in thread \"main\" "
+                        "java.lang.OutOfMemoryError: Java heap space\n");
+        exit(1);
+    }
+
+    gettimeofday(&end, NULL);
+    trace_span("gc", major ? "full GC" : "GC", NULL, trace_start);
+    if (gc_verbose) {
+        long us = elapsed_us(&start, &minor_end);
+        /* allocation rate of the program since the previous collection */
+        long mutator_us = elapsed_us(&object_heap.last_collection, &start);
+        size_t allocated =
+            object_heap.allocated_bytes - object_heap.allocated_at_collection;
+        fprintf(stderr,
+                "[GC young %zuK, %zu objects promoted, old %zuK->%zuK, "
+                "%ld.%03ld ms, allocated %zuK at %.1f MB/s]\n",
+                young / 1024, promoted, before / 1024, after_minor / 1024,
+                us / 1000, us % 1000, allocated / 1024,
+                mutator_us ? allocated / (double) mutator_us : 0.0);
+        if (major) {
+            us = elapsed_us(&minor_end, &end);
+            fprintf(stderr,
+                    "[Full GC %zuK->%zuK(%zuK), %zu objects freed, "
+                    "%ld.%03ld ms: roots %ld.%03ld, mark %ld.%03ld, "
+                    "sweep %ld.%03ld ms, %d thread%s]\n",
+                    after_minor / 1024, object_heap.bytes / 1024,
+                    object_heap.max_bytes / 1024, freed, us / 1000,
+                    us % 1000, roots_us / 1000, roots_us % 1000,
+                    mark_us / 1000, mark_us % 1000, sweep_us / 1000,
+                    sweep_us % 1000, worker_count,
+                    worker_count > 1 ? "s" : "");
+        }
+    }
+    object_heap.allocated_at_collection = object_heap.allocated_bytes;
+    object_heap.last_collection = end;
+}
+
+/* parse a -Xmx style size: a number of bytes with an optional k, m or g */
+bool parse_heap_size(const char *arg, size_t *size)
+{
+    char *end;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (end == arg)
+        return false;
+    switch (*end) {
+    case 'k':
+    case 'K':
+        value <<= 10;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        value <<= 20;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        value <<= 30;
+        end++;
+        break;
+    }
+    if (*end || value == 0)
+        return false;
+    *size = value;
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* default -Xmx */
+#define GC_DEFAULT_MAX_HEAP ((size_t) 256 * 1024 * 1024)
+/* old space bytes before the first major collection */
+#define GC_INITIAL_THRESHOLD ((size_t) 4 * 1024 * 1024)
+/* upper bound of the number of collector workers */
+#define GC_MAX_THREADS 64
+
+/* set when a collection should run at the next safepoint */
+extern bool gc_requested;
+/* set along with gc_requested when the old space must be collected too */
+extern bool gc_full;
+/* report every collection on stderr */
+extern bool gc_verbose;
+/* workers of major collections, one per processor when 0 */
+extern int gc_threads;
+
+void collect_garbage();
+bool parse_heap_size(const char *arg, size_t *size);
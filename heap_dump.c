@@ -0,0 +1,636 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE /* SA_RESTART */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "class_heap.h"
+#include "gc.h"
+#include "heap_dump.h"
+#include "object_heap.h"
+#include "stack.h"
+
+volatile sig_atomic_t heap_dump_requested = 0;
+char *heap_dump_path = NULL;
+bool heap_dump_at_exit = false;
+
+/* class path of the program, see jvm.c */
+extern char *prefix;
+
+/**
+ * Heap dumps in the HPROF binary format of the JDK, version 1.0.2, which
+ * heap analyzers read. Identifiers are addresses: objects are identified by
+ * their references, classes by their class_file_t, and names by their text
+ * in the constant pool.
+ *
+ * Strings are laid out as in the JDK, an instance of java/lang/String whose
+ * value field refers to a byte array holding the characters. The array is
+ * made up for the dump, its identifier being the reference to the string
+ * plus 8, which no object has as they are all aligned to 16.
+ */
+
+/* record tags */
+#define HPROF_UTF8 0x01
+#define HPROF_LOAD_CLASS 0x02
+#define HPROF_TRACE 0x05
+#define HPROF_HEAP_DUMP_SEGMENT 0x1c
+#define HPROF_HEAP_DUMP_END 0x2c
+
+/* heap dump sub-record tags */
+#define HPROF_GC_ROOT_UNKNOWN 0xff
+#define HPROF_GC_ROOT_JAVA_FRAME 0x03
+#define HPROF_GC_ROOT_STICKY_CLASS 0x05
+#define HPROF_GC_CLASS_DUMP 0x20
+#define HPROF_GC_INSTANCE_DUMP 0x21
+#define HPROF_GC_OBJ_ARRAY_DUMP 0x22
+#define HPROF_GC_PRIM_ARRAY_DUMP 0x23
+
+/* basic types, those of primitives are array_type_t */
+#define HPROF_OBJECT 2
+
+/* serial number of the empty stack trace every object is given */
+#define HPROF_TRACE_SERIAL 1
+/* serial number of the thread running main */
+#define HPROF_THREAD_SERIAL 1
+
+/* a heap dump segment is closed once it is this large */
+#define HPROF_SEGMENT_LIMIT ((long) 1 << 30)
+
+static FILE *out;
+static long segment_start; /* offset of the length of the open segment */
+static char *requested_path;
+static int dump_count;
+
+/* classes made up for the arrays, identified by their names */
+static const char object_array_class[] = "[Ljava/lang/Object;";
+static const char *primitive_array_classes[] = {
+    [T_BOOLEN] = "[Z", [T_CHAR] = "[C",  [T_FLOAT] = "[F", [T_DOUBLE] = "[D",
+    [T_BYTE] = "[B",   [T_SHORT] = "[S", [T_INT] = "[I",   [T_LONG] = "[J",
+};
+/* the fields of java/lang/String in the dump */
+static const char string_value_field[] = "value";
+static const char string_coder_field[] = "coder";
+
+static void signal_handler(int signal)
+{
+    (void) signal;
+    heap_dump_requested = 1;
+}
+
+void init_heap_dump()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+/* dump the heap to path, a malloc'ed string owned from now on, or to the
+ * default path when NULL, at the next safepoint */
+void request_heap_dump(char *path)
+{
+    free(requested_path);
+    requested_path = path;
+    heap_dump_requested = 1;
+}
+
+static inline void write_u1(u1 value)
+{
+    putc(value, out);
+}
+
+static inline void write_u2(u2 value)
+{
+    putc(value >> 8, out);
+    putc(value, out);
+}
+
+static inline void write_u4(u4 value)
+{
+    write_u2(value >> 16);
+    write_u2(value);
+}
+
+static inline void write_u8(u8 value)
+{
+    write_u4(value >> 32);
+    write_u4(value);
+}
+
+static inline void write_id(const void *id)
+{
+    write_u8((uintptr_t) id);
+}
+
+static void write_record(u1 tag, u4 length)
+{
+    write_u1(tag);
+    write_u4(0); /* microseconds since the header */
+    write_u4(length);
+}
+
+static void write_utf8(const char *text)
+{
+    size_t length = strlen(text);
+    write_record(HPROF_UTF8, sizeof(u8) + length);
+    write_id(text);
+    fwrite(text, 1, length, out);
+}
+
+static void begin_segment()
+{
+    write_u1(HPROF_HEAP_DUMP_SEGMENT);
+    write_u4(0);
+    segment_start = ftell(out);
+    write_u4(0); /* patched by end_segment() */
+}
+
+static void end_segment()
+{
+    long end = ftell(out);
+    fseek(out, segment_start, SEEK_SET);
+    write_u4(end - segment_start - sizeof(u4));
+    fseek(out, end, SEEK_SET);
+}
+
+/* keep segments within what their u4 length can tell */
+static void split_segment()
+{
+    if (ftell(out) - segment_start > HPROF_SEGMENT_LIMIT) {
+        end_segment();
+        begin_segment();
+    }
+}
+
+/* HPROF basic type of a field descriptor */
+static u1 basic_type(char descriptor)
+{
+    switch (descriptor) {
+    case 'Z':
+        return T_BOOLEN;
+    case 'C':
+        return T_CHAR;
+    case 'F':
+        return T_FLOAT;
+    case 'D':
+        return T_DOUBLE;
+    case 'B':
+        return T_BYTE;
+    case 'S':
+        return T_SHORT;
+    case 'I':
+        return T_INT;
+    case 'J':
+        return T_LONG;
+    default:
+        return HPROF_OBJECT;
+    }
+}
+
+static size_t basic_type_size(u1 type)
+{
+    return type == HPROF_OBJECT ? sizeof(u8) : array_element_size(type);
+}
+
+static bool is_reference(variable_type_t type)
+{
+    return type == VAR_PTR || type == VAR_STR_PTR || type == VAR_ARRAY_PTR ||
+           type == VAR_MULTARRAY_PTR;
+}
+
+/* write the value of a field, as stored by the interpreter */
+static void write_value(u1 type, variable_t *value)
+{
+    switch (basic_type_size(type)) {
+    case 1:
+        write_u1(value->value.char_value);
+        break;
+    case 2:
+        write_u2(value->value.short_value);
+        break;
+    case 4:
+        write_u4(value->value.int_value);
+        break;
+    default:
+        if (type == HPROF_OBJECT)
+            write_id(is_reference(value->type) ? value->value.ptr_value
+                                               : NULL);
+        else
+            write_u8(value->value.long_value);
+        break;
+    }
+}
+
+static char *class_name(class_file_t *clazz)
+{
+    return find_class_name_from_index(clazz->this_class, clazz);
+}
+
+static class_file_t *super_class(class_file_t *clazz)
+{
+    if (!clazz->super_class)
+        return NULL;
+    char *name = find_class_name_from_index(clazz->super_class, clazz);
+    class_file_t *super = find_class_from_heap(name);
+    if (!super) {
+        char *tmp = malloc(strlen(name) + strlen(prefix) + 1);
+        strcpy(tmp, prefix);
+        strcat(tmp, name);
+        super = find_class_from_heap(tmp);
+        free(tmp);
+    }
+    return super;
+}
+
+static bool is_string_class(class_file_t *clazz)
+{
+    return strcmp(class_name(clazz), "java/lang/String") == 0;
+}
+
+/* bytes of the instance fields declared by clazz */
+static u4 instance_fields_size(class_file_t *clazz)
+{
+    if (is_string_class(clazz))
+        return sizeof(u8) + 1;
+    u4 size = 0;
+    for (u2 i = 0; i < clazz->fields_count; i++) {
+        if (!(clazz->fields[i].access_flags & ACC_STATIC))
+            size += basic_type_size(basic_type(clazz->fields[i].descriptor[0]));
+    }
+    return size;
+}
+
+static void write_names()
+{
+    write_utf8(object_array_class);
+    for (u1 type = T_BOOLEN; type <= T_LONG; type++)
+        write_utf8(primitive_array_classes[type]);
+    write_utf8(string_value_field);
+    write_utf8(string_coder_field);
+    for (int i = 0; i < class_heap.length; i++) {
+        class_file_t *clazz = class_heap.class_info[i]->clazz;
+        write_utf8(class_name(clazz));
+        for (u2 j = 0; j < clazz->fields_count; j++)
+            write_utf8(clazz->fields[j].name);
+    }
+}
+
+static void write_load_class(u4 serial, const void *id, const char *name)
+{
+    write_record(HPROF_LOAD_CLASS, 2 * sizeof(u4) + 2 * sizeof(u8));
+    write_u4(serial);
+    write_id(id);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_id(name);
+}
+
+static void write_classes()
+{
+    u4 serial = 1;
+    write_load_class(serial++, object_array_class, object_array_class);
+    for (u1 type = T_BOOLEN; type <= T_LONG; type++)
+        write_load_class(serial++, primitive_array_classes[type],
+                         primitive_array_classes[type]);
+    for (int i = 0; i < class_heap.length; i++) {
+        class_file_t *clazz = class_heap.class_info[i]->clazz;
+        write_load_class(serial++, clazz, class_name(clazz));
+    }
+}
+
+/* class dump of an array class, a subclass of java/lang/Object */
+static void write_array_class_dump(const void *id, class_file_t *object)
+{
+    write_u1(HPROF_GC_CLASS_DUMP);
+    write_id(id);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_id(object);
+    for (int i = 0; i < 5; i++)
+        write_id(NULL); /* loader, signers, domain and reserved */
+    write_u4(0);        /* instance size */
+    write_u2(0);        /* constant pool */
+    write_u2(0);        /* static fields */
+    write_u2(0);        /* instance fields */
+}
+
+static void write_class_dump(class_file_t *clazz)
+{
+    write_u1(HPROF_GC_CLASS_DUMP);
+    write_id(clazz);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_id(super_class(clazz));
+    for (int i = 0; i < 5; i++)
+        write_id(NULL);
+    write_u4(object_block_size(clazz) - sizeof(heap_header_t));
+    write_u2(0);
+
+    u2 statics = 0, instance = 0;
+    for (u2 i = 0; i < clazz->fields_count; i++) {
+        if (clazz->fields[i].access_flags & ACC_STATIC)
+            statics++;
+        else
+            instance++;
+    }
+    write_u2(statics);
+    for (u2 i = 0; i < clazz->fields_count; i++) {
+        field_t *field = &clazz->fields[i];
+        if (!(field->access_flags & ACC_STATIC))
+            continue;
+        u1 type = basic_type(field->descriptor[0]);
+        write_id(field->name);
+        write_u1(type);
+        write_value(type, field->value);
+    }
+
+    if (is_string_class(clazz)) {
+        write_u2(2);
+        write_id(string_value_field);
+        write_u1(HPROF_OBJECT);
+        write_id(string_coder_field);
+        write_u1(T_BYTE);
+        return;
+    }
+    write_u2(instance);
+    for (u2 i = 0; i < clazz->fields_count; i++) {
+        field_t *field = &clazz->fields[i];
+        if (field->access_flags & ACC_STATIC)
+            continue;
+        write_id(field->name);
+        write_u1(basic_type(field->descriptor[0]));
+    }
+}
+
+static void write_instance_dump(object_t *obj)
+{
+    class_file_t *clazz = obj->type;
+    u4 size = 0;
+    for (class_file_t *c = clazz; c; c = super_class(c))
+        size += instance_fields_size(c);
+
+    write_u1(HPROF_GC_INSTANCE_DUMP);
+    write_id(obj);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_id(clazz);
+    write_u4(size);
+    for (u2 i = 0; i < clazz->fields_count; i++) {
+        field_t *field = &clazz->fields[i];
+        if (!(field->access_flags & ACC_STATIC))
+            write_value(basic_type(field->descriptor[0]), &obj->ptr[i]);
+    }
+    /* objects only hold the fields of their class, those inherited are
+     * written as zero to keep the layout analyzers expect */
+    for (class_file_t *c = super_class(clazz); c; c = super_class(c)) {
+        for (u4 i = instance_fields_size(c); i; i--)
+            write_u1(0);
+    }
+}
+
+static void write_string_dump(string_t *str, class_file_t *string_class)
+{
+    size_t size = string_size(str->length, str->coder);
+    write_u1(HPROF_GC_INSTANCE_DUMP);
+    write_id(str);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_id(string_class);
+    write_u4(sizeof(u8) + 1);
+    write_id((char *) str + 8);
+    write_u1(str->coder);
+
+    write_u1(HPROF_GC_PRIM_ARRAY_DUMP);
+    write_id((char *) str + 8);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_u4(size);
+    write_u1(T_BYTE);
+    fwrite(str->value, 1, size, out);
+}
+
+static void write_array_dump(heap_header_t *header)
+{
+    void *array = header + 1;
+    if (header->kind == OBJECT_REF_ARRAY) {
+        ref_t *elements = array;
+        write_u1(HPROF_GC_OBJ_ARRAY_DUMP);
+        write_id(array);
+        write_u4(HPROF_TRACE_SERIAL);
+        write_u4(header->length);
+        write_id(object_array_class);
+        for (u4 i = 0; i < header->length; i++)
+            write_id(decode_ref(elements[i]));
+        return;
+    }
+
+    write_u1(HPROF_GC_PRIM_ARRAY_DUMP);
+    write_id(array);
+    write_u4(HPROF_TRACE_SERIAL);
+    write_u4(header->length);
+    write_u1(header->type);
+    /* elements are big-endian */
+    switch (array_element_size(header->type)) {
+    case 1:
+        fwrite(array, 1, header->length, out);
+        break;
+    case 2:
+        for (u4 i = 0; i < header->length; i++)
+            write_u2(((u2 *) array)[i]);
+        break;
+    case 4:
+        for (u4 i = 0; i < header->length; i++)
+            write_u4(((u4 *) array)[i]);
+        break;
+    default:
+        for (u4 i = 0; i < header->length; i++)
+            write_u8(((u8 *) array)[i]);
+        break;
+    }
+}
+
+static void write_object(heap_header_t *header, class_file_t *string_class)
+{
+    switch (header->kind) {
+    case OBJECT_INSTANCE:
+        write_instance_dump((object_t *) (header + 1));
+        break;
+    case OBJECT_STRING:
+        write_string_dump((string_t *) (header + 1), string_class);
+        break;
+    case OBJECT_ARRAY:
+    case OBJECT_REF_ARRAY:
+        write_array_dump(header);
+        break;
+    case OBJECT_MULTIARRAY: {
+        /* every array of the block is an object of its own */
+        char *end = (char *) header + header->size;
+        for (char *p = (char *) (header + 1); p < end;) {
+            heap_header_t *array = (heap_header_t *) p;
+            write_array_dump(array);
+            p += array_block_size(array->length,
+                                  array->kind == OBJECT_ARRAY
+                                      ? array_element_size(array->type)
+                                      : sizeof(ref_t));
+        }
+    } break;
+    default:
+        break;
+    }
+    split_segment();
+}
+
+/* write the blocks laid out back to back from start to end */
+static void write_blocks(char *start, char *end, class_file_t *string_class)
+{
+    for (char *p = start; p < end;) {
+        heap_header_t *header = (heap_header_t *) p;
+        write_object(header, string_class);
+        p += header->size;
+    }
+}
+
+static void write_root(u1 tag, void *ref)
+{
+    write_u1(tag);
+    write_id(ref);
+}
+
+static void write_interned_root(void **slot)
+{
+    write_root(HPROF_GC_ROOT_UNKNOWN, *slot);
+}
+
+static void write_frame_entries(stack_entry_t *entries,
+                                size_t count,
+                                u4 depth)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].type != STACK_ENTRY_REF || !entries[i].entry.ptr_value)
+            continue;
+        write_root(HPROF_GC_ROOT_JAVA_FRAME, entries[i].entry.ptr_value);
+        write_u4(HPROF_THREAD_SERIAL);
+        write_u4(depth);
+    }
+}
+
+static void write_frame_roots(class_file_t *string_class)
+{
+    u4 depth = 0;
+    for (frame_t *frame = current_frame; frame; frame = frame->prev) {
+        write_frame_entries(frame->locals, frame->max_locals, depth);
+        if (frame->op_stack)
+            write_frame_entries(frame->op_stack->store, frame->op_stack->size,
+                                depth);
+        /* objects allocated in the frame are not in the heap */
+        for (u2 i = 0; i < frame->frame_object_count; i++) {
+            heap_header_t *header = frame->frame_objects[i];
+            if (header)
+                write_object(header, string_class);
+        }
+        depth++;
+    }
+}
+
+static void write_heap_dump()
+{
+    class_file_t *string_class = find_class_from_heap("java/lang/String");
+    if (!string_class) {
+        for (int i = 0; i < class_heap.length && !string_class; i++) {
+            if (is_string_class(class_heap.class_info[i]->clazz))
+                string_class = class_heap.class_info[i]->clazz;
+        }
+    }
+    class_file_t *object_class = NULL;
+    for (int i = 0; i < class_heap.length && !object_class; i++) {
+        class_file_t *clazz = class_heap.class_info[i]->clazz;
+        if (strcmp(class_name(clazz), "java/lang/Object") == 0)
+            object_class = clazz;
+    }
+
+    begin_segment();
+    write_array_class_dump(object_array_class, object_class);
+    for (u1 type = T_BOOLEN; type <= T_LONG; type++)
+        write_array_class_dump(primitive_array_classes[type], object_class);
+    for (int i = 0; i < class_heap.length; i++) {
+        class_file_t *clazz = class_heap.class_info[i]->clazz;
+        write_class_dump(clazz);
+        /* loaded classes are never unloaded */
+        write_root(HPROF_GC_ROOT_STICKY_CLASS, clazz);
+    }
+    write_frame_roots(string_class);
+    visit_interned_strings(write_interned_root);
+
+    write_blocks(object_heap.nursery, object_heap.young_top, string_class);
+    for (region_t *region = object_heap.regions; region;
+         region = region->next)
+        write_blocks(REGION_OBJECTS(region), region->end, string_class);
+    for (size_t i = 0; i < object_heap.length; i++)
+        write_object(object_heap.objects[i], string_class);
+    end_segment();
+    write_record(HPROF_HEAP_DUMP_END, 0);
+}
+
+/**
+ * Write the live objects to an HPROF file, after a full collection has
+ * freed the others. Must be called at a safepoint, or once no frame is left.
+ */
+void dump_heap()
+{
+    heap_dump_requested = 0;
+    char *path = requested_path;
+    requested_path = NULL;
+    if (!path) {
+        char default_path[32];
+        snprintf(default_path, sizeof(default_path), "java_pid%ld.hprof",
+                 (long) getpid());
+        const char *base = heap_dump_path ? heap_dump_path : default_path;
+        /* later dumps to the same path are numbered */
+        path = malloc(strlen(base) + 12);
+        assert(path && "Failed to allocate heap dump path");
+        if (dump_count)
+            sprintf(path, "%s.%d", base, dump_count);
+        else
+            strcpy(path, base);
+        dump_count++;
+    }
+
+    gc_full = true;
+    collect_garbage();
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    fprintf(stderr, "Dumping heap to %s ...\n", path);
+    out = fopen(path, "wb");
+    if (!out) {
+        perror(path);
+        free(path);
+        return;
+    }
+    static char buffer[1 << 16];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+
+    fwrite("JAVA PROFILE 1.0.2", 1, sizeof("JAVA PROFILE 1.0.2"), out);
+    write_u4(sizeof(u8));
+    u8 millis = (u8) start.tv_sec * 1000 + start.tv_usec / 1000;
+    write_u8(millis);
+
+    write_names();
+    write_classes();
+    write_record(HPROF_TRACE, 3 * sizeof(u4));
+    write_u4(HPROF_TRACE_SERIAL);
+    write_u4(HPROF_THREAD_SERIAL);
+    write_u4(0); /* no frames */
+    write_heap_dump();
+
+    long size = ftell(out);
+    int error = fclose(out);
+    assert(!error && "Failed to write heap dump");
+    out = NULL;
+    gettimeofday(&end, NULL);
+    long us = (end.tv_sec - start.tv_sec) * 1000000L +
+              (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "Heap dump file created [%ld bytes in %ld.%03ld secs]\n",
+            size, us / 1000000, us / 1000 % 1000);
+    free(path);
+}
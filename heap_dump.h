@@ -0,0 +1,16 @@
+#pragma once
+
+#include <signal.h>
+#include <stdbool.h>
+
+/* set by SIGUSR1 or System.dumpHeap(), the dump is written at the next
+ * safepoint */
+extern volatile sig_atomic_t heap_dump_requested;
+/* -XX:HeapDumpPath, java_pid<pid>.hprof when NULL */
+extern char *heap_dump_path;
+/* -XX:+HeapDumpAtExit */
+extern bool heap_dump_at_exit;
+
+void init_heap_dump();
+void request_heap_dump(char *path);
+void dump_heap();
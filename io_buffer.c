@@ -0,0 +1,281 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "io_buffer.h"
+#include "java_string.h"
+
+/**
+ * VM-owned buffer for standard output. Java output is only handed to the
+ * kernel on PrintStream.flush(), at exit, or when the buffer is full.
+ *
+ * In the default mode there is a single chunk written with write(2). In
+ * writev mode up to OUTPUT_MAX_CHUNKS chunks are filled before they are
+ * flushed together by one writev(2), which suits programs producing very
+ * large outputs.
+ */
+typedef struct {
+    char *chunks[OUTPUT_MAX_CHUNKS];
+    int max_chunks;
+    int current; /* chunk being filled */
+    size_t used; /* bytes used in current chunk */
+} output_buffer_t;
+
+static output_buffer_t output;
+
+void init_output(bool use_writev)
+{
+    output.max_chunks = use_writev ? OUTPUT_MAX_CHUNKS : 1;
+    output.chunks[0] = malloc(OUTPUT_CHUNK_SIZE);
+    assert(output.chunks[0] && "Failed to allocate output buffer");
+    output.current = 0;
+    output.used = 0;
+    atexit(output_flush);
+}
+
+/* write the whole iovec array, retrying on partial writes */
+static void write_all(struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t written = count == 1
+                              ? write(STDOUT_FILENO, iov->iov_base, iov->iov_len)
+                              : writev(STDOUT_FILENO, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void output_flush()
+{
+    if (!output.chunks[0])
+        return;
+
+    struct iovec iov[OUTPUT_MAX_CHUNKS];
+    int count = 0;
+    for (int i = 0; i < output.current; i++) {
+        iov[count].iov_base = output.chunks[i];
+        iov[count++].iov_len = OUTPUT_CHUNK_SIZE;
+    }
+    if (output.used) {
+        iov[count].iov_base = output.chunks[output.current];
+        iov[count++].iov_len = output.used;
+    }
+    write_all(iov, count);
+    output.current = 0;
+    output.used = 0;
+}
+
+/* make room in the buffer once the current chunk is full */
+static void output_next_chunk()
+{
+    if (output.current + 1 >= output.max_chunks) {
+        output_flush();
+        return;
+    }
+    output.current++;
+    if (!output.chunks[output.current]) {
+        output.chunks[output.current] = malloc(OUTPUT_CHUNK_SIZE);
+        assert(output.chunks[output.current] &&
+               "Failed to allocate output buffer");
+    }
+    output.used = 0;
+}
+
+void output_write(const char *src, size_t len)
+{
+    while (len > 0) {
+        if (output.used == OUTPUT_CHUNK_SIZE)
+            output_next_chunk();
+        size_t n = OUTPUT_CHUNK_SIZE - output.used;
+        if (n > len)
+            n = len;
+        memcpy(output.chunks[output.current] + output.used, src, n);
+        output.used += n;
+        src += n;
+        len -= n;
+    }
+}
+
+void output_char(char c)
+{
+    if (output.used == OUTPUT_CHUNK_SIZE)
+        output_next_chunk();
+    output.chunks[output.current][output.used++] = c;
+}
+
+void output_long(int64_t value)
+{
+    char buf[24];
+    output_write(buf, format_decimal(value, buf));
+}
+
+/**
+ * Write characters of a string payload encoded as UTF-8. ASCII runs of
+ * Latin-1 strings are copied as they are, surrogate pairs are combined and
+ * unpaired surrogates are written as U+FFFD.
+ */
+void output_chars(const char *value, size_t length, u1 coder)
+{
+    const u2 *value16 = (const u2 *) value;
+    for (size_t i = 0; i < length;) {
+        u4 c;
+        if (coder == STRING_LATIN1) {
+            size_t ascii = ascii_prefix(value + i, length - i);
+            output_write(value + i, ascii);
+            i += ascii;
+            if (i == length)
+                break;
+            c = (u1) value[i++];
+        } else {
+            c = value16[i++];
+            if (c >= 0xD800 && c < 0xDC00 && i < length &&
+                value16[i] >= 0xDC00 && value16[i] < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (value16[i++] - 0xDC00);
+            } else if (c >= 0xD800 && c < 0xE000) {
+                c = 0xFFFD;
+            }
+        }
+
+        if (c < 0x80) {
+            output_char(c);
+        } else if (c < 0x800) {
+            output_char(0xC0 | c >> 6);
+            output_char(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            output_char(0xE0 | c >> 12);
+            output_char(0x80 | (c >> 6 & 0x3F));
+            output_char(0x80 | (c & 0x3F));
+        } else {
+            output_char(0xF0 | c >> 18);
+            output_char(0x80 | (c >> 12 & 0x3F));
+            output_char(0x80 | (c >> 6 & 0x3F));
+            output_char(0x80 | (c & 0x3F));
+        }
+    }
+}
+
+/**
+ * Buffer for standard input. When stdin is a regular file it is mapped as a
+ * whole, otherwise it is read in large blocks into a buffer that grows to
+ * hold the longest line. Lines are returned as pointers into the buffer.
+ */
+typedef struct {
+    char *data;
+    size_t size;  /* capacity of data, or length of the mapping */
+    size_t start; /* first byte not yet returned */
+    size_t end;   /* end of valid bytes */
+    size_t scan;  /* bytes before this offset contain no newline */
+    bool mapped;
+    bool eof;
+    bool ready;
+} input_buffer_t;
+
+static input_buffer_t input;
+
+static void init_input()
+{
+    struct stat st;
+    input.ready = true;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                         STDIN_FILENO, 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+            input.data = map;
+            input.size = st.st_size;
+            input.start = input.scan = offset < 0 ? 0 : offset;
+            input.end = st.st_size;
+            input.mapped = true;
+            input.eof = true;
+            return;
+        }
+    }
+    input.size = INPUT_BUFFER_SIZE;
+    input.data = malloc(input.size);
+    assert(input.data && "Failed to allocate input buffer");
+}
+
+/* move pending bytes to the front, grow if full, and read more input */
+static void input_refill()
+{
+    if (input.start > 0) {
+        memmove(input.data, input.data + input.start, input.end - input.start);
+        input.end -= input.start;
+        input.scan -= input.start;
+        input.start = 0;
+    }
+    if (input.end == input.size) {
+        input.size *= 2;
+        input.data = realloc(input.data, input.size);
+        assert(input.data && "Failed to grow input buffer");
+    }
+    ssize_t n;
+    do {
+        n = read(STDIN_FILENO, input.data + input.end, input.size - input.end);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        input.eof = true;
+    else
+        input.end += n;
+}
+
+/**
+ * Get the next line of standard input without its line terminator.
+ * The returned pointer stays valid until the next call.
+ *
+ * @return false when the input is exhausted
+ */
+bool input_read_line(const char **line, size_t *len)
+{
+    if (!input.ready)
+        init_input();
+
+    char *newline;
+    while (!(newline = memchr(input.data + input.scan, '\n',
+                              input.end - input.scan))) {
+        input.scan = input.end;
+        if (input.eof)
+            break;
+        input_refill();
+    }
+
+    if (!newline && input.start == input.end)
+        return false;
+
+    size_t line_end = newline ? (size_t)(newline - input.data) : input.end;
+    *line = input.data + input.start;
+    *len = line_end - input.start;
+    if (*len > 0 && (*line)[*len - 1] == '\r')
+        (*len)--;
+    input.start = input.scan = newline ? line_end + 1 : input.end;
+    return true;
+}
+
+void free_input()
+{
+    if (input.mapped)
+        munmap(input.data, input.size);
+    else
+        free(input.data);
+}
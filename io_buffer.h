@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "type.h"
+
+/* size of one output chunk */
+#define OUTPUT_CHUNK_SIZE (64 * 1024)
+/* chunks gathered into a single writev(2) in writev mode */
+#define OUTPUT_MAX_CHUNKS 64
+
+/* initial size of the refillable input buffer, grown for longer lines */
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+void init_output(bool use_writev);
+void output_write(const char *src, size_t len);
+void output_char(char c);
+void output_long(int64_t value);
+void output_chars(const char *value, size_t length, u1 coder);
+void output_flush();
+bool input_read_line(const char **line, size_t *len);
+void free_input();
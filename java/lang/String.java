@@ -2,5 +2,11 @@ package java.lang;
 
 public class String {
     public native char charAt(int x);
+    public native int length();
     public native int compareTo(String s);
+    public native int indexOf(int ch);
+    public native int indexOf(String s);
+    public native int hashCode();
+    public native boolean equals(Object o);
+    public native String intern();
 }
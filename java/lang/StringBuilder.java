@@ -0,0 +1,27 @@
+package java.lang;
+
+public final class StringBuilder {
+    /* backing store, its length is the capacity */
+    private String value;
+    private int count;
+
+    public StringBuilder() {
+        this.count = 0;
+    }
+
+    public StringBuilder(String s) {
+        this.count = 0;
+        append(s);
+    }
+
+    public int length() {
+        return this.count;
+    }
+
+    public native StringBuilder append(String s);
+    public native StringBuilder append(char c);
+    public native StringBuilder append(int i);
+    public native StringBuilder append(long l);
+    public native void setLength(int newLength);
+    public native String toString();
+}
@@ -8,5 +8,6 @@ public abstract class System {
     public static final PrintStream out = new PrintStream();
     public static final PrintStream err = new PrintStream();
     public native static void gc();
+    public native static void dumpHeap(String path);
     public native static long currentTimeMillis();
 }
@@ -1,4 +1,6 @@
 #include "java_file.h"
+#include "stats.h"
+#include "trace.h"
 
 /* Read unsigned big-endian integers */
 u1 read_u1(FILE *class_file)
@@ -110,6 +112,26 @@ field_t *find_field(const char *name, const char *desc, class_file_t *clazz)
     return NULL;
 }
 
+/**
+ * Find the source line of an instruction, that of the entry of the
+ * LineNumberTable starting the closest before it.
+ *
+ * @param code the code of the method
+ * @param pc the offset of the instruction
+ * @return the line number, or 0 when the method has no LineNumberTable
+ */
+u2 line_number_of(code_t *code, u4 pc)
+{
+    line_number_t *found = NULL;
+    for (u2 i = 0; i < code->line_number_count; i++) {
+        line_number_t *entry = &code->line_numbers[i];
+        if (entry->start_pc <= pc &&
+            (!found || entry->start_pc > found->start_pc))
+            found = entry;
+    }
+    return found ? found->line_number : 0;
+}
+
 /**
  * Find the method with the given name and signature.
  * The descriptor is necessary because Java allows method overloading.
@@ -327,6 +349,7 @@ constant_pool_t get_constant_pool(FILE *class_file)
             CONSTANT_String_info *value = malloc(sizeof(*value));
             assert(value && "Failed to allocate String constant");
             value->string_index = read_u2(class_file);
+            value->resolved = NULL;
             constant->info = (u1 *) value;
             break;
         }
@@ -336,6 +359,7 @@ constant_pool_t get_constant_pool(FILE *class_file)
             assert(value && "Failed to allocate InvokeDynamic constant");
             value->bootstrap_method_attr_index = read_u2(class_file);
             value->name_and_type_index = read_u2(class_file);
+            value->recipe = NULL;
             constant->info = (u1 *) value;
             break;
         }
@@ -377,6 +401,46 @@ void read_field_attributes(FILE *class_file, field_info *info)
     }
 }
 
+/* read the attributes of the Code attribute that follow the code */
+static void read_code_attributes(FILE *class_file,
+                                 code_t *code,
+                                 constant_pool_t *cp)
+{
+    /* exception handlers are not supported */
+    u2 exception_table_length = read_u2(class_file);
+    fseek(class_file, exception_table_length * 8, SEEK_CUR);
+
+    u2 attributes_count = read_u2(class_file);
+    for (u2 i = 0; i < attributes_count; i++) {
+        attribute_info ainfo = {
+            .attribute_name_index = read_u2(class_file),
+            .attribute_length = read_u4(class_file),
+        };
+        long attribute_end = ftell(class_file) + ainfo.attribute_length;
+        const_pool_info *type_constant =
+            get_constant(cp, ainfo.attribute_name_index);
+        assert(type_constant->tag == CONSTANT_Utf8 && "Expected a UTF8");
+        if (!strcmp((char *) type_constant->info, "LineNumberTable")) {
+            /* there may be several tables, each with a part of the lines */
+            u2 length = read_u2(class_file);
+            if (!length)
+                continue;
+            code->line_numbers =
+                realloc(code->line_numbers,
+                        sizeof(line_number_t) *
+                            (code->line_number_count + length));
+            assert(code->line_numbers && "Failed to allocate line numbers");
+            for (u2 j = 0; j < length; j++) {
+                line_number_t *entry =
+                    &code->line_numbers[code->line_number_count++];
+                entry->start_pc = read_u2(class_file);
+                entry->line_number = read_u2(class_file);
+            }
+        }
+        fseek(class_file, attribute_end, SEEK_SET);
+    }
+}
+
 void read_method_attributes(FILE *class_file,
                             method_info *info,
                             code_t *code,
@@ -384,6 +448,8 @@ void read_method_attributes(FILE *class_file,
 {
     bool found_code = false;
     code->code = NULL;
+    code->line_number_count = 0;
+    code->line_numbers = NULL;
     for (u2 i = 0; i < info->attributes_count; i++) {
         attribute_info ainfo = {
             .attribute_name_index = read_u2(class_file),
@@ -406,6 +472,7 @@ void read_method_attributes(FILE *class_file,
                 fread(code->code, 1, code->code_length, class_file);
             assert(bytes_read == code->code_length &&
                    "Failed to read method code");
+            read_code_attributes(class_file, code, cp);
         }
         /* Skip the rest of the attribute */
         fseek(class_file, attribute_end, SEEK_SET);
@@ -451,7 +518,8 @@ field_t *get_fields(FILE *class_file, constant_pool_t *cp, class_file_t *clazz)
         const_pool_info *descriptor = get_constant(cp, info.descriptor_index);
         assert(descriptor->tag == CONSTANT_Utf8 && "Expected a UTF8");
         field->descriptor = (char *) descriptor->info;
-        field->value = malloc(sizeof(variable_t));
+        field->access_flags = info.access_flags;
+        field->value = calloc(1, sizeof(variable_t));
 
         read_field_attributes(class_file, &info);
     }
@@ -483,6 +551,9 @@ method_t *get_methods(FILE *class_file, constant_pool_t *cp)
         assert(descriptor->tag == CONSTANT_Utf8 && "Expected a UTF8");
         method->descriptor = (char *) descriptor->info;
         method->access_flag = info.access_flags;
+        method->native_method = NULL;
+        method->escape = NULL;
+        method->opcode_stats = NULL;
 
         read_method_attributes(class_file, &info, &method->code, cp);
     }
@@ -552,6 +623,9 @@ bootstrapMethods_attribute_t *read_bootstrap_attribute(FILE *class_file,
  */
 class_file_t get_class(FILE *class_file)
 {
+    u8 start = trace_now();
+    vm_phase_t left = enter_phase(PHASE_USER_LOAD);
+
     /* Read the leading header of the class file */
     get_class_header(class_file);
 
@@ -573,5 +647,9 @@ class_file_t get_class(FILE *class_file)
     /* Read the list of attributes */
     clazz.bootstrap =
         read_bootstrap_attribute(class_file, &clazz.constant_pool);
+
+    trace_span("class", "parse",
+               find_class_name_from_index(clazz.this_class, &clazz), start);
+    enter_phase(left);
     return clazz;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "stack.h"
 #include "type.h"
 
 typedef struct {
@@ -34,11 +35,19 @@ typedef struct {
     u4 attribute_length;
 } attribute_info;
 
+/* entry of the LineNumberTable of a method */
+typedef struct {
+    u2 start_pc; /* of the first instruction of the line */
+    u2 line_number;
+} line_number_t;
+
 typedef struct {
     u2 max_stack;
     u2 max_locals;
     u4 code_length;
     u1 *code;
+    u2 line_number_count;
+    line_number_t *line_numbers; /* NULL without a LineNumberTable */
 } code_t;
 
 typedef struct {
@@ -54,18 +63,31 @@ typedef struct {
     bootstrap_methods_t *bootstrap_methods;
 } bootstrapMethods_attribute_t;
 
-typedef struct {
+/* C implementation of an ACC_NATIVE method. The arguments are the slice of
+ * the caller's operand stack holding them (args[0] is this pointer for
+ * instance methods), and the result is returned by value.
+ */
+typedef stack_value_t (*native_method_t)(stack_entry_t *args);
+
+typedef struct method {
     char *class_name;
     char *name;
     char *descriptor;
     code_t code;
     u2 access_flag;
+    /* bound when the class is added to class heap */
+    native_method_t native_method;
+    u2 native_argc;     /* operand stack slots taken, including this */
+    char native_return; /* first character of return descriptor */
+    struct escape_info *escape; /* built on first use, see escape.h */
+    struct opcode_stats *opcode_stats; /* see opcode_stats.h */
 } method_t;
 
 typedef struct {
     char *class_name;
     char *name;
     char *descriptor;
+    u2 access_flags;
     variable_t *value;
 } field_t;
 
@@ -104,11 +126,36 @@ typedef struct {
 
 typedef struct {
     u2 string_index;
+    /* interned string object, resolved on first ldc */
+    void *resolved;
 } CONSTANT_String_info;
 
+/* one piece of a string concatenation recipe */
+typedef struct {
+    const char *text; /* decoded constant text, NULL for an argument */
+    u4 length;        /* characters in text, or index of the argument */
+} concat_segment_t;
+
+/**
+ * makeConcatWithConstants recipe compiled once per call site, allocated as a
+ * single block followed by its segments, argument types and constant text.
+ */
+typedef struct {
+    u2 num_args;
+    u2 num_segments;
+    u1 coder;           /* string coder of the constant text */
+    u4 constant_length; /* total characters of constant text */
+    char *arg_types;    /* descriptor character of each argument */
+    concat_segment_t segments[];
+} concat_recipe_t;
+
+/* argument type of a java/lang/String, other references and arrays are 'L' */
+#define CONCAT_STRING 'T'
+
 typedef struct {
     u2 bootstrap_method_attr_index;
     u2 name_and_type_index;
+    concat_recipe_t *recipe;
 } CONSTANT_InvokeDynamic_info;
 
 typedef struct {
@@ -151,7 +198,7 @@ typedef struct {
     const_pool_info *constant_pool;
 } constant_pool_t;
 
-typedef struct {
+typedef struct class_file {
     constant_pool_t constant_pool;
     // u2 methods_count;
     method_t *methods;
@@ -175,6 +222,7 @@ typedef struct {
 
 
 typedef enum {
+    i_aconst_null = 0x1,
     i_iconst_m1 = 0x2,
     i_iconst_0 = 0x3,
     i_iconst_1 = 0x4,
@@ -202,7 +250,13 @@ typedef enum {
     i_aload_2 = 0x2c,
     i_aload_3 = 0x2d,
     i_iaload = 0x2e,
+    i_laload = 0x2f,
+    i_faload = 0x30,
+    i_daload = 0x31,
     i_aaload = 0x32,
+    i_baload = 0x33,
+    i_caload = 0x34,
+    i_saload = 0x35,
     i_istore = 0x36,
     i_lstore = 0x37,
     i_astore = 0x3a,
@@ -219,6 +273,14 @@ typedef enum {
     i_astore_2 = 0x4d,
     i_astore_3 = 0x4e,
     i_iastore = 0x4f,
+    i_lastore = 0x50,
+    i_fastore = 0x51,
+    i_dastore = 0x52,
+    i_aastore = 0x53,
+    i_bastore = 0x54,
+    i_castore = 0x55,
+    i_sastore = 0x56,
+    i_pop = 0x57,
     i_dup = 0x59,
     i_dup2 = 0x5c,
     i_iadd = 0x60,
@@ -233,7 +295,9 @@ typedef enum {
     i_ineg = 0x74,
     i_iinc = 0x84,
     i_i2l = 0x85,
+    i_i2b = 0x91,
     i_i2c = 0x92,
+    i_i2s = 0x93,
     i_lcmp = 0x94,
     i_ifeq = 0x99,
     i_ifne = 0x9a,
@@ -263,6 +327,8 @@ typedef enum {
     i_invokedynamic = 0xba,
     i_new = 0xbb,
     i_newarray = 0xbc,
+    i_anewarray = 0xbd,
+    i_arraylength = 0xbe,
     i_multianewarray = 0xc5,
     i_ifnull = 0xc6
 } jvm_opcode_t;
@@ -278,6 +344,7 @@ CONSTANT_FieldOrMethodRef_info *get_methodref(constant_pool_t *cp, u2 idx);
 CONSTANT_FieldOrMethodRef_info *get_fieldref(constant_pool_t *cp, u2 idx);
 uint16_t get_number_of_parameters(method_t *method);
 field_t *find_field(const char *name, const char *desc, class_file_t *clazz);
+u2 line_number_of(code_t *code, u4 pc);
 method_t *find_method(const char *name, const char *desc, class_file_t *clazz);
 method_t *find_method_from_index(uint16_t idx,
                                  class_file_t *clazz,
@@ -0,0 +1,611 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "java_string.h"
+
+/* length of the leading run of ASCII bytes, 16 bytes at a time with SSE2 */
+size_t ascii_prefix(const char *src, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i *) (src + i)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        u8 word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & 0x8080808080808080ULL)
+            break;
+    }
+    while (i < len && !(src[i] & 0x80))
+        i++;
+    return i;
+}
+
+bool is_ascii(const char *src, size_t len)
+{
+    return ascii_prefix(src, len) == len;
+}
+
+/**
+ * Decode one non-ASCII character of (Modified) UTF-8. Both the two byte form
+ * of U+0000 used by class files and four byte sequences from standard UTF-8
+ * are accepted, malformed input decodes to U+FFFD.
+ *
+ * @return number of bytes consumed
+ */
+static size_t utf8_decode_char(const u1 *src, const u1 *end, u4 *code_point)
+{
+    u1 byte = src[0];
+    size_t n;
+    u4 value;
+    if (byte >= 0xC0 && byte < 0xE0) {
+        n = 2;
+        value = byte & 0x1F;
+    } else if (byte >= 0xE0 && byte < 0xF0) {
+        n = 3;
+        value = byte & 0x0F;
+    } else if (byte >= 0xF0 && byte < 0xF5) {
+        n = 4;
+        value = byte & 0x07;
+    } else {
+        *code_point = 0xFFFD;
+        return 1;
+    }
+    if ((size_t) (end - src) < n) {
+        *code_point = 0xFFFD;
+        return 1;
+    }
+    for (size_t i = 1; i < n; i++) {
+        if ((src[i] & 0xC0) != 0x80) {
+            *code_point = 0xFFFD;
+            return 1;
+        }
+        value = value << 6 | (src[i] & 0x3F);
+    }
+    *code_point = value > 0x10FFFF ? 0xFFFD : value;
+    return n;
+}
+
+/**
+ * Count the UTF-16 code units of decoded (Modified) UTF-8, and pick the
+ * compact encoding that can hold them.
+ */
+size_t utf8_decoded_length(const char *src, size_t len, u1 *coder)
+{
+    const u1 *p = (const u1 *) src, *end = p + len;
+    size_t length = 0;
+    *coder = STRING_LATIN1;
+    while (p < end) {
+        size_t ascii = ascii_prefix((const char *) p, end - p);
+        length += ascii;
+        p += ascii;
+        if (p == end)
+            break;
+        u4 code_point;
+        p += utf8_decode_char(p, end, &code_point);
+        if (code_point > 0xFF)
+            *coder = STRING_UTF16;
+        length += code_point >= 0x10000 ? 2 : 1;
+    }
+    return length;
+}
+
+/* decode (Modified) UTF-8 into a payload sized by utf8_decoded_length() */
+void utf8_decode(const char *src, size_t len, char *dest, u1 coder)
+{
+    const u1 *p = (const u1 *) src, *end = p + len;
+    u2 *dest16 = (u2 *) dest;
+    while (p < end) {
+        size_t ascii = ascii_prefix((const char *) p, end - p);
+        if (coder == STRING_LATIN1) {
+            memcpy(dest, p, ascii);
+            dest += ascii;
+        } else {
+            copy_chars((char *) dest16, STRING_UTF16, (const char *) p,
+                       STRING_LATIN1, ascii);
+            dest16 += ascii;
+        }
+        p += ascii;
+        if (p == end)
+            break;
+
+        u4 code_point;
+        p += utf8_decode_char(p, end, &code_point);
+        if (coder == STRING_LATIN1) {
+            *dest++ = (char) code_point;
+        } else if (code_point >= 0x10000) {
+            code_point -= 0x10000;
+            *dest16++ = 0xD800 | (code_point >> 10);
+            *dest16++ = 0xDC00 | (code_point & 0x3FF);
+        } else {
+            *dest16++ = code_point;
+        }
+    }
+}
+
+/**
+ * Copy count characters between payloads, widening Latin-1 to UTF-16 when
+ * needed. Narrowing is only valid if every character fits in Latin-1.
+ */
+void copy_chars(char *dest,
+                u1 dest_coder,
+                const char *src,
+                u1 src_coder,
+                size_t count)
+{
+    if (dest_coder == src_coder) {
+        memcpy(dest, src, string_size(count, src_coder));
+        return;
+    }
+    if (dest_coder == STRING_LATIN1) {
+        const u2 *src16 = (const u2 *) src;
+        for (size_t i = 0; i < count; i++)
+            dest[i] = (char) src16[i];
+        return;
+    }
+
+    u2 *dest16 = (u2 *) dest;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dest16 + i),
+                         _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128((__m128i *) (dest16 + i + 8),
+                         _mm_unpackhi_epi8(bytes, zero));
+    }
+#endif
+    for (; i < count; i++)
+        dest16[i] = (u1) src[i];
+}
+
+/* narrowest coder able to hold the characters of a payload */
+u1 narrowest_coder(const char *value, size_t length, u1 coder)
+{
+    const u2 *value16 = (const u2 *) value;
+    if (coder == STRING_LATIN1)
+        return coder;
+    for (size_t i = 0; i < length; i++) {
+        if (value16[i] > 0xFF)
+            return STRING_UTF16;
+    }
+    return STRING_LATIN1;
+}
+
+/**
+ * Offset of the first differing byte of a and b, or n if they are equal.
+ * Compares 32 bytes at a time with AVX2, 16 with SSE2.
+ */
+static size_t mismatch(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i eq =
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                              _mm256_loadu_si256((const __m256i *) (b + i)));
+        u4 mask = ~(u4) _mm256_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                    _mm_loadu_si128((const __m128i *) (b + i)));
+        u4 mask = ~_mm_movemask_epi8(eq) & 0xFFFF;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+#if defined(__SSE2__) && !defined(__AVX2__)
+/* SSE2 has no 32-bit multiply keeping the low halves, build it from the
+ * even and odd 64-bit products */
+static inline __m128i mullo_epi32(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+/**
+ * s[0]*31^(n-1) + s[1]*31^(n-2) + ... + s[n-1]
+ *
+ * The vector paths keep one accumulator per lane, lane j summing the
+ * characters at j, j + lanes, ... each scaled by 31^lanes per step. Folding
+ * the lanes with 31 afterwards gives the hash of the prefix, and the tail
+ * continues with the scalar recurrence.
+ */
+u4 hash_chars(const char *value, size_t length, u1 coder)
+{
+    const u2 *value16 = (const u2 *) value;
+    u4 hash = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    if (length >= 8) {
+        const __m256i factor = _mm256_set1_epi32(2487512833u); /* 31^8 */
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 8 <= length; i += 8) {
+            __m256i chars =
+                coder == STRING_LATIN1
+                    ? _mm256_cvtepu8_epi32(
+                          _mm_loadl_epi64((const __m128i *) (value + i)))
+                    : _mm256_cvtepu16_epi32(
+                          _mm_loadu_si128((const __m128i *) (value16 + i)));
+            acc = _mm256_add_epi32(_mm256_mullo_epi32(acc, factor), chars);
+        }
+        u4 lanes[8];
+        _mm256_storeu_si256((__m256i *) lanes, acc);
+        for (int j = 0; j < 8; j++)
+            hash = 31 * hash + lanes[j];
+    }
+#elif defined(__SSE2__)
+    if (length >= 4) {
+        const __m128i factor = _mm_set1_epi32(923521); /* 31^4 */
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        for (; i + 4 <= length; i += 4) {
+            __m128i chars;
+            if (coder == STRING_LATIN1) {
+                int32_t bytes;
+                memcpy(&bytes, value + i, sizeof(bytes));
+                chars = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+            } else {
+                chars = _mm_loadl_epi64((const __m128i *) (value16 + i));
+            }
+            chars = _mm_unpacklo_epi16(chars, zero);
+            acc = _mm_add_epi32(mullo_epi32(acc, factor), chars);
+        }
+        u4 lanes[4];
+        _mm_storeu_si128((__m128i *) lanes, acc);
+        for (int j = 0; j < 4; j++)
+            hash = 31 * hash + lanes[j];
+    }
+#endif
+    if (coder == STRING_LATIN1) {
+        for (; i < length; i++)
+            hash = 31 * hash + (u1) value[i];
+    } else {
+        for (; i < length; i++)
+            hash = 31 * hash + value16[i];
+    }
+    return hash;
+}
+
+/* String.hashCode, computed once per string */
+u4 string_hash(string_t *str)
+{
+    if (!str->hashed) {
+        str->hash = hash_chars(str->value, str->length, str->coder);
+        str->hashed = true;
+    }
+    return str->hash;
+}
+
+/* strings are always stored in the narrowest coder, so strings of
+ * different coders are never equal */
+bool string_equals(string_t *str1, string_t *str2)
+{
+    if (str1 == str2)
+        return true;
+    if (!str2 || str1->length != str2->length || str1->coder != str2->coder)
+        return false;
+    if (str1->hashed && str2->hashed && str1->hash != str2->hash)
+        return false;
+    size_t size = string_size(str1->length, str1->coder);
+    return mismatch(str1->value, str2->value, size) == size;
+}
+
+/**
+ * lexicographic comparison with the semantics of String.compareTo, strings of
+ * the same coder skip their common prefix as bytes
+ */
+int32_t string_compare(string_t *str1, string_t *str2)
+{
+    u4 end = str1->length < str2->length ? str1->length : str2->length;
+    u4 i = 0;
+    if (str1->coder == str2->coder)
+        i = mismatch(str1->value, str2->value,
+                     string_size(end, str1->coder)) >>
+            str1->coder;
+    for (; i < end; i++) {
+        int32_t result = string_char_at(str1, i) - string_char_at(str2, i);
+        if (result != 0)
+            return result;
+    }
+    return (int32_t) str1->length - (int32_t) str2->length;
+}
+
+/* index of the first char c in a Latin-1 or UTF-16 payload, or -1 */
+static int32_t find_char(const char *value, size_t length, u1 coder, u2 c)
+{
+    const u2 *value16 = (const u2 *) value;
+    size_t size = string_size(length, coder), i = 0;
+#if defined(__AVX2__)
+    const __m256i needle256 = coder == STRING_LATIN1 ? _mm256_set1_epi8(c)
+                                                     : _mm256_set1_epi16(c);
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (value + i));
+        __m256i eq = coder == STRING_LATIN1
+                         ? _mm256_cmpeq_epi8(block, needle256)
+                         : _mm256_cmpeq_epi16(block, needle256);
+        u4 mask = _mm256_movemask_epi8(eq);
+        if (mask)
+            return (i + __builtin_ctz(mask)) >> coder;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i needle = coder == STRING_LATIN1 ? _mm_set1_epi8(c)
+                                                  : _mm_set1_epi16(c);
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (value + i));
+        __m128i eq = coder == STRING_LATIN1 ? _mm_cmpeq_epi8(block, needle)
+                                            : _mm_cmpeq_epi16(block, needle);
+        u4 mask = _mm_movemask_epi8(eq);
+        if (mask)
+            return (i + __builtin_ctz(mask)) >> coder;
+    }
+#endif
+    for (i >>= coder; i < length; i++) {
+        if ((coder == STRING_LATIN1 ? (u1) value[i] : value16[i]) == c)
+            return i;
+    }
+    return -1;
+}
+
+/* String.indexOf(int), supplementary code points are searched as their
+ * surrogate pair */
+int32_t string_index_of_char(string_t *str, int32_t code_point)
+{
+    if (code_point < 0 || code_point > 0x10FFFF)
+        return -1;
+    if (code_point <= 0xFFFF) {
+        if (str->coder == STRING_LATIN1 && code_point > 0xFF)
+            return -1;
+        return find_char(str->value, str->length, str->coder, code_point);
+    }
+    if (str->coder == STRING_LATIN1)
+        return -1;
+
+    code_point -= 0x10000;
+    u2 high = 0xD800 | (code_point >> 10), low = 0xDC00 | (code_point & 0x3FF);
+    const u2 *value16 = (const u2 *) str->value;
+    for (u4 i = 0; i + 1 < str->length;) {
+        int32_t found = find_char(str->value + i * 2, str->length - i,
+                                  STRING_UTF16, high);
+        if (found < 0 || i + found + 1 >= str->length)
+            break;
+        i += found;
+        if (value16[i + 1] == low)
+            return i;
+        i++;
+    }
+    return -1;
+}
+
+/**
+ * String.indexOf(String). For strings of the same coder, candidates are the
+ * positions matching both the first and the last character of sub, found a
+ * vector at a time, and only those are compared in full.
+ */
+int32_t string_index_of(string_t *str, string_t *sub)
+{
+    if (sub->length == 0)
+        return 0;
+    if (sub->length > str->length)
+        return -1;
+    /* sub has a character beyond Latin-1, which str cannot contain */
+    if (str->coder == STRING_LATIN1 && sub->coder == STRING_UTF16)
+        return -1;
+
+    u4 last = str->length - sub->length;
+    u4 i = 0;
+    if (str->coder == sub->coder) {
+        u1 coder = str->coder;
+        size_t sub_size = string_size(sub->length, coder);
+        size_t last_offset = string_size(sub->length - 1, coder);
+        size_t end = string_size(last, coder);
+        size_t offset = 0;
+#if defined(__SSE2__)
+        u2 first_char = string_char_at(sub, 0);
+        u2 last_char = string_char_at(sub, sub->length - 1);
+        const __m128i first = coder == STRING_LATIN1
+                                  ? _mm_set1_epi8(first_char)
+                                  : _mm_set1_epi16(first_char);
+        const __m128i final = coder == STRING_LATIN1
+                                  ? _mm_set1_epi8(last_char)
+                                  : _mm_set1_epi16(last_char);
+        for (; offset + 16 <= end + string_size(1, coder); offset += 16) {
+            __m128i block_first =
+                _mm_loadu_si128((const __m128i *) (str->value + offset));
+            __m128i block_last = _mm_loadu_si128(
+                (const __m128i *) (str->value + offset + last_offset));
+            __m128i eq =
+                coder == STRING_LATIN1
+                    ? _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                    _mm_cmpeq_epi8(block_last, final))
+                    : _mm_and_si128(_mm_cmpeq_epi16(block_first, first),
+                                    _mm_cmpeq_epi16(block_last, final));
+            u4 mask = _mm_movemask_epi8(eq);
+            if (coder == STRING_UTF16)
+                mask &= 0x5555;
+            while (mask) {
+                size_t candidate = offset + __builtin_ctz(mask);
+                if (memcmp(str->value + candidate, sub->value, sub_size) == 0)
+                    return candidate >> coder;
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; offset <= end; offset += string_size(1, coder)) {
+            if (memcmp(str->value + offset, sub->value, sub_size) == 0)
+                return offset >> coder;
+        }
+        return -1;
+    }
+
+    /* UTF-16 str and Latin-1 sub */
+    for (; i <= last; i++) {
+        u4 j = 0;
+        while (j < sub->length &&
+               string_char_at(str, i + j) == string_char_at(sub, j))
+            j++;
+        if (j == sub->length)
+            return i;
+    }
+    return -1;
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* number of characters in the decimal form of value */
+size_t decimal_length(int64_t value)
+{
+    uint64_t n = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    size_t len = value < 0 ? 2 : 1;
+    while (n >= 10) {
+        n /= 10;
+        len++;
+    }
+    return len;
+}
+
+/**
+ * Write the decimal form of value, two digits at a time from the end.
+ * dest must have room for decimal_length(value) characters, which is also
+ * the returned length. No terminator is written.
+ */
+size_t format_decimal(int64_t value, char *dest)
+{
+    size_t len = decimal_length(value);
+    char *p = dest + len;
+    uint64_t n = value < 0 ? -(uint64_t) value : (uint64_t) value;
+
+    while (n >= 100) {
+        unsigned idx = (n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    if (n >= 10) {
+        *--p = digit_pairs[n * 2 + 1];
+        *--p = digit_pairs[n * 2];
+    } else {
+        *--p = '0' + n;
+    }
+    if (value < 0)
+        *--p = '-';
+    return len;
+}
+
+/* VM-wide table of interned strings, open addressing with linear probing */
+typedef struct {
+    u4 capacity;
+    u4 count;
+    string_t **slots;
+} intern_table_t;
+
+static intern_table_t intern_table;
+
+string_t *find_interned_string(const char *value, size_t length, u1 coder)
+{
+    if (!intern_table.slots)
+        return NULL;
+
+    u4 mask = intern_table.capacity - 1;
+    for (u4 i = hash_chars(value, length, coder) & mask;
+         intern_table.slots[i]; i = (i + 1) & mask) {
+        string_t *str = intern_table.slots[i];
+        if (str->length == length && str->coder == coder &&
+            memcmp(str->value, value, string_size(length, coder)) == 0)
+            return str;
+    }
+    return NULL;
+}
+
+static void intern_table_insert(string_t *str)
+{
+    u4 mask = intern_table.capacity - 1;
+    u4 i = string_hash(str) & mask;
+    while (intern_table.slots[i])
+        i = (i + 1) & mask;
+    intern_table.slots[i] = str;
+}
+
+/* keep the load factor under one half */
+static void intern_table_grow()
+{
+    string_t **old_slots = intern_table.slots;
+    u4 old_capacity = intern_table.capacity;
+
+    intern_table.capacity =
+        old_capacity ? old_capacity * 2 : INTERN_TABLE_SIZE;
+    intern_table.slots = calloc(intern_table.capacity, sizeof(string_t *));
+    assert(intern_table.slots && "Failed to allocate intern table");
+    for (u4 i = 0; i < old_capacity; i++) {
+        if (old_slots[i])
+            intern_table_insert(old_slots[i]);
+    }
+    free(old_slots);
+}
+
+/**
+ * Get the canonical string with the same content as str, str itself becomes
+ * canonical if there was none.
+ */
+string_t *intern_string(string_t *str)
+{
+    string_t *interned =
+        find_interned_string(str->value, str->length, str->coder);
+    if (interned)
+        return interned;
+
+    if ((intern_table.count + 1) * 2 > intern_table.capacity)
+        intern_table_grow();
+    intern_table_insert(str);
+    intern_table.count++;
+    return str;
+}
+
+/* call visit on the slot of every interned string, which it may update */
+void visit_interned_strings(void (*visit)(void **slot))
+{
+    for (u4 i = 0; i < intern_table.capacity; i++) {
+        if (intern_table.slots[i])
+            visit((void **) &intern_table.slots[i]);
+    }
+}
+
+void free_intern_table()
+{
+    free(intern_table.slots);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "type.h"
+
+/* encoding of string payload */
+typedef enum {
+    STRING_LATIN1 = 0, /* one byte per character */
+    STRING_UTF16 = 1   /* one u2 per character, only if some char > 0xFF */
+} string_coder_t;
+
+/**
+ * Layout of a java/lang/String, allocated as a single block. The payload is
+ * kept NUL-terminated so it can be handed to C library functions, but the
+ * length is authoritative and the payload may contain NUL characters.
+ */
+typedef struct {
+    u4 length; /* number of characters */
+    u4 hash;   /* cached hashCode, valid when hashed is set */
+    bool hashed;
+    u1 coder; /* string_coder_t */
+    char value[];
+} string_t;
+
+static inline u2 string_char_at(const string_t *str, u4 index)
+{
+    if (str->coder == STRING_LATIN1)
+        return (u1) str->value[index];
+    return ((const u2 *) str->value)[index];
+}
+
+/* size of payload in bytes, without terminator */
+static inline size_t string_size(size_t length, u1 coder)
+{
+    return length << coder;
+}
+
+/* initial capacity of a StringBuilder buffer */
+#define STRING_BUILDER_CAPACITY 16
+
+/* initial capacity of the intern table, must be a power of two */
+#define INTERN_TABLE_SIZE 256
+
+size_t ascii_prefix(const char *src, size_t len);
+bool is_ascii(const char *src, size_t len);
+size_t utf8_decoded_length(const char *src, size_t len, u1 *coder);
+void utf8_decode(const char *src, size_t len, char *dest, u1 coder);
+void copy_chars(char *dest,
+                u1 dest_coder,
+                const char *src,
+                u1 src_coder,
+                size_t count);
+u1 narrowest_coder(const char *value, size_t length, u1 coder);
+u4 hash_chars(const char *value, size_t length, u1 coder);
+u4 string_hash(string_t *str);
+bool string_equals(string_t *str1, string_t *str2);
+int32_t string_compare(string_t *str1, string_t *str2);
+int32_t string_index_of_char(string_t *str, int32_t code_point);
+int32_t string_index_of(string_t *str, string_t *sub);
+size_t decimal_length(int64_t value);
+size_t format_decimal(int64_t value, char *dest);
+string_t *find_interned_string(const char *value, size_t length, u1 coder);
+string_t *intern_string(string_t *str);
+void visit_interned_strings(void (*visit)(void **slot));
+void free_intern_table();
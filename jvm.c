@@ -1,48 +1,375 @@
 /* PitifulVM is a minimalist Java Virtual Machine implementation written in C.
  */
 
+#include <alloca.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc_profile.h"
 #include "class_heap.h"
+#include "cpu_profile.h"
+#include "escape.h"
+#include "gc.h"
+#include "heap_dump.h"
+#include "io_buffer.h"
 #include "java_file.h"
 #include "native.h"
 #include "object_heap.h"
+#ifdef OPCODE_STATS
+#include "opcode_stats.h"
+#endif
 #include "stack.h"
+#include "stats.h"
+#include "trace.h"
 
 /* TODO: add -cp arg to achieve class path select */
 char *prefix;
 
 /**
- * Execute the opcode instructions of a method until it returns.
- *
- * @param method the method to run
- * @param locals the array of local variables, including the method parameters.
- *               Except for parameters, the locals are uninitialized.
- * @param clazz the class file the method belongs to
- * @return the method return variable, a heap-allocated pointer, should be free
- * from caller;
- *
+ * Call a native method. Its arguments are passed as the slice of the operand
+ * stack they were pushed to, then replaced by the result.
+ */
+static void invoke_native(method_t *method, stack_frame_t *op_stack)
+{
+    assert(method->native_method && "unsatisfied link to native method");
+    stack_entry_t *args =
+        &op_stack->store[op_stack->size - method->native_argc];
+    native_calls++;
+    stack_value_t result = method->native_method(args);
+    op_stack->size -= method->native_argc;
+
+    switch (method->native_return) {
+    case 'V':
+        break;
+    case 'J':
+        push_long(op_stack, result.long_value);
+        break;
+    case 'L':
+    case '[':
+        push_ref(op_stack, result.ptr_value);
+        break;
+    default:
+        push_int(op_stack, result.int_value);
+        break;
+    }
+}
+
+/**
+ * Compile the recipe of a makeConcatWithConstants call site into segments of
+ * constant text and arguments, so it is parsed only once.
+ */
+static concat_recipe_t *compile_concat_recipe(uint16_t index,
+                                              class_file_t *clazz)
+{
+    bootstrap_methods_t *bootstrap_method =
+        find_bootstrap_method(index, clazz);
+
+    /* we only support makeConcatWithConstants (string concatenation),
+     * this mean argument must be only one string */
+    assert(bootstrap_method->num_bootstrap_arguments == 1 &&
+           "only support makeConcatWithConstants");
+    char *recipe = get_string_utf(&clazz->constant_pool,
+                                  bootstrap_method->bootstrap_arguments[0]);
+
+    const_pool_info *info = get_constant(&clazz->constant_pool, index);
+    const_pool_info *name_and_type = get_constant(
+        &clazz->constant_pool,
+        ((CONSTANT_InvokeDynamic_info *) info->info)->name_and_type_index);
+    char *descriptor =
+        (char *) get_constant(&clazz->constant_pool,
+                              ((CONSTANT_NameAndType_info *)
+                                   name_and_type->info)
+                                  ->descriptor_index)
+            ->info;
+
+    /* each \u0001 mean "1" in unicode, this should be replace by actual
+     * argument from stack, others are constant characters. Constant text is
+     * decoded once here, in the coder wide enough for all of it. */
+    u2 num_args = 0, num_segments = 0;
+    u1 coder = STRING_LATIN1;
+    size_t constant_length = 0;
+    for (char *tmp = recipe; *tmp;) {
+        if (*tmp == 1) {
+            num_args++;
+            num_segments++;
+            tmp++;
+            continue;
+        }
+        char *end = strchr(tmp, 1);
+        if (!end)
+            end = tmp + strlen(tmp);
+        u1 segment_coder;
+        constant_length += utf8_decoded_length(tmp, end - tmp, &segment_coder);
+        if (segment_coder > coder)
+            coder = segment_coder;
+        num_segments++;
+        tmp = end;
+    }
+
+    /* text is placed first after the segments to keep UTF-16 aligned */
+    size_t text_size = string_size(constant_length, coder);
+    concat_recipe_t *compiled =
+        malloc(sizeof(concat_recipe_t) +
+               sizeof(concat_segment_t) * num_segments + text_size + num_args);
+    assert(compiled && "Failed to allocate concatenation recipe");
+    compiled->num_args = num_args;
+    compiled->num_segments = num_segments;
+    compiled->coder = coder;
+    compiled->constant_length = constant_length;
+    char *text = (char *) &compiled->segments[num_segments];
+    compiled->arg_types = text + text_size;
+
+    /* argument types from the call site descriptor, strings apart from
+     * other references, arrays of any type being references too */
+    u2 arg = 0;
+    for (char *tmp = descriptor + 1; *tmp != ')'; tmp++) {
+        assert(arg < num_args && "recipe does not match descriptor");
+        while (*tmp == '[')
+            tmp++;
+        compiled->arg_types[arg] = tmp[0];
+        if (tmp[-1] == '[')
+            compiled->arg_types[arg] = 'L';
+        else if (!strncmp(tmp, "Ljava/lang/String;", 18))
+            compiled->arg_types[arg] = CONCAT_STRING;
+        if (*tmp == 'L')
+            tmp = strchr(tmp, ';');
+        arg++;
+    }
+
+    concat_segment_t *segment = compiled->segments;
+    arg = 0;
+    for (char *tmp = recipe; *tmp;) {
+        if (*tmp == 1) {
+            segment->text = NULL;
+            segment->length = arg++;
+            tmp++;
+        } else {
+            char *end = strchr(tmp, 1);
+            if (!end)
+                end = tmp + strlen(tmp);
+            u1 segment_coder;
+            segment->text = text;
+            segment->length =
+                utf8_decoded_length(tmp, end - tmp, &segment_coder);
+            utf8_decode(tmp, end - tmp, text, coder);
+            text += string_size(segment->length, coder);
+            tmp = end;
+        }
+        segment++;
+    }
+    return compiled;
+}
+
+/**
+ * string of a reference argument of a concatenation, or NULL for null.
+ * Objects would need toString(), which is not supported, so a reference
+ * passed as anything but a String must turn out to be one at run time.
+ */
+static string_t *concat_arg_string(char type, stack_entry_t *arg)
+{
+    void *ref = arg->entry.ptr_value;
+    if (type != CONCAT_STRING && ref &&
+        header_of(ref)->kind != OBJECT_STRING) {
+        fprintf(stderr, "string concatenation only supports strings, "
+                        "not other objects or arrays\n");
+        exit(1);
+    }
+    return ref;
+}
+
+/**
+ * number of characters an argument of a concatenation contributes, widening
+ * coder if the argument does not fit in Latin-1
+ */
+static size_t concat_arg_length(char type, stack_entry_t *arg, u1 *coder)
+{
+    switch (type) {
+    case CONCAT_STRING:
+    case 'L': {
+        string_t *str = concat_arg_string(type, arg);
+        if (!str)
+            return 4;
+        if (str->coder > *coder)
+            *coder = str->coder;
+        return str->length;
+    }
+    case 'C':
+        if ((u2) stack_to_int(&arg->entry, get_type_size(arg->type)) > 0xFF)
+            *coder = STRING_UTF16;
+        return 1;
+    case 'Z':
+        return arg->entry.int_value ? 4 : 5;
+    default:
+        return decimal_length(
+            stack_to_int(&arg->entry, get_type_size(arg->type)));
+    }
+}
+
+static char *concat_arg_write(char type,
+                              stack_entry_t *arg,
+                              char *out,
+                              u1 coder)
+{
+    const char *latin1;
+    size_t len;
+    char buf[24];
+    switch (type) {
+    case CONCAT_STRING:
+    case 'L': {
+        /* checked by concat_arg_length() already */
+        string_t *str = arg->entry.ptr_value;
+        if (!str) {
+            latin1 = "null";
+            len = 4;
+            break;
+        }
+        copy_chars(out, coder, str->value, str->coder, str->length);
+        return out + string_size(str->length, coder);
+    }
+    case 'C': {
+        u2 c = stack_to_int(&arg->entry, get_type_size(arg->type));
+        if (coder == STRING_LATIN1) {
+            *out = (char) c;
+            return out + 1;
+        }
+        memcpy(out, &c, sizeof(c));
+        return out + sizeof(c);
+    }
+    case 'Z':
+        latin1 = arg->entry.int_value ? "true" : "false";
+        len = arg->entry.int_value ? 4 : 5;
+        break;
+    default: {
+        int64_t value = stack_to_int(&arg->entry, get_type_size(arg->type));
+        if (coder == STRING_LATIN1)
+            return out + format_decimal(value, out);
+        latin1 = buf;
+        len = format_decimal(value, buf);
+        break;
+    }
+    }
+    copy_chars(out, coder, latin1, STRING_LATIN1, len);
+    return out + string_size(len, coder);
+}
+
+/**
+ * Concatenate the arguments on top of the operand stack following a compiled
+ * recipe. The exact length and coder are computed first, so the result is the
+ * only allocation and is written in one pass.
  */
+static string_t *concat_strings(concat_recipe_t *recipe,
+                                stack_frame_t *op_stack,
+                                class_file_t *clazz)
+{
+    stack_entry_t *args = &op_stack->store[op_stack->size - recipe->num_args];
+
+    size_t len = recipe->constant_length;
+    u1 coder = recipe->coder;
+    for (u2 i = 0; i < recipe->num_args; i++)
+        len += concat_arg_length(recipe->arg_types[i], &args[i], &coder);
+
+    string_t *dest = alloc_string(clazz, len, coder);
+    char *out = dest->value;
+    for (u2 i = 0; i < recipe->num_segments; i++) {
+        concat_segment_t *segment = &recipe->segments[i];
+        if (segment->text) {
+            copy_chars(out, coder, segment->text, recipe->coder,
+                       segment->length);
+            out += string_size(segment->length, coder);
+        } else {
+            out = concat_arg_write(recipe->arg_types[segment->length],
+                                   &args[segment->length], out, coder);
+        }
+    }
+    op_stack->size -= recipe->num_args;
+    return dest;
+}
+
 stack_entry_t *execute(method_t *method,
                        local_variable_t *locals,
-                       class_file_t *clazz)
+                       class_file_t *clazz);
+
+/* uncaught exception, which ends the program as exceptions are not thrown */
+static void index_out_of_bounds(int32_t index, u4 length)
+{
+    char message[96];
+    snprintf(message, sizeof(message),
+             "ArrayIndexOutOfBoundsException: Index %d out of bounds for "
+             "length %u",
+             index, length);
+    throw_exception(message);
+}
+
+static inline void check_null(void *ref)
+{
+    if (!ref)
+        throw_exception("NullPointerException");
+}
+
+/* bounds check of an array access, negative indexes compare as too large */
+static inline void check_index(void *arr, int32_t index)
+{
+    check_null(arr);
+    u4 length = header_of(arr)->length;
+    if ((u4) index >= length)
+        index_out_of_bounds(index, length);
+}
+
+static inline void check_array_size(int32_t count)
+{
+    if (count < 0) {
+        char message[64];
+        snprintf(message, sizeof(message), "NegativeArraySizeException: %d",
+                 count);
+        throw_exception(message);
+    }
+}
+
+/* run the opcode instructions of a method in the given frame */
+static stack_entry_t *interpret(method_t *method,
+                                local_variable_t *locals,
+                                class_file_t *clazz,
+                                frame_t *frame)
 {
     code_t code = method->code;
     stack_frame_t *op_stack = malloc(sizeof(stack_frame_t));
     init_stack(op_stack, code.max_stack);
+    frame->op_stack = op_stack;
+
+    /* objects of the allocation sites escape analysis keeps in the frame,
+     * allocated on the first run of each site */
+    if (escape_analysis) {
+        u2 sites = method_escape_info(method)->site_count;
+        frame->frame_objects = alloca(sizeof(void *) * sites);
+        memset(frame->frame_objects, 0, sizeof(void *) * sites);
+        frame->frame_object_count = sites;
+    }
 
     /* position at the program to be run */
     uint32_t pc = 0;
     uint8_t *code_buf = code.code;
 
-    int loop_count = 0;
+#ifdef OPCODE_STATS
+    opcode_stats_t *stats = method_opcode_stats(method, clazz);
+    int previous = -1; /* opcode run before the current one in this frame */
+#endif
     while (pc < code.code_length) {
-        loop_count += 1;
         uint8_t current = code_buf[pc];
+        frame->pc = pc;
+#ifdef OPCODE_STATS
+        count_opcode(stats, previous, current);
+        previous = current;
+#endif
+
+        /* allocation only requests a collection, it runs here where every
+         * live reference is held by a frame */
+        if (gc_requested)
+            collect_garbage();
+        if (heap_dump_requested)
+            dump_heap();
 
         /* Reference:
          * https://en.wikipedia.org/wiki/Java_bytecode_instruction_listings
@@ -141,49 +468,11 @@ stack_entry_t *execute(method_t *method,
                 find_method(method_name, method_descriptor, target_class);
             uint16_t num_params = get_number_of_parameters(own_method);
             if (own_method->access_flag & ACC_NATIVE) {
-                /* FIXME: locals size must be determined */
-                local_variable_t own_locals[20];
-                memset(own_locals, 0, sizeof(own_locals));
-
-                for (int i = num_params; i >= 1; i--) {
-                    pop_to_local(op_stack, &own_locals[i]);
-                }
-
-                /* method return void */
-                if (method_descriptor[strlen(method_descriptor) - 1] == 'V') {
-                    void_native_method(method, own_locals);
-                    /* method return long */
-                } else if (method_descriptor[strlen(method_descriptor) - 1] ==
-                           'J') {
-                    void *exec_res = ptr_native_method(own_method, own_locals);
-                    if (exec_res) {
-                        push_long(op_stack, *(int64_t *) exec_res);
-                    }
-                    free(exec_res);
-                    /* method return int */
-                } else if (method_descriptor[strlen(method_descriptor) - 1] ==
-                           'I') {
-                    void *exec_res = ptr_native_method(own_method, own_locals);
-                    if (exec_res) {
-                        push_int(op_stack, *(int32_t *) exec_res);
-                    }
-                    free(exec_res);
-                    /* method return char */
-                } else if (method_descriptor[strlen(method_descriptor) - 1] ==
-                           'C') {
-                    void *exec_res = ptr_native_method(own_method, own_locals);
-                    if (exec_res) {
-                        push_byte(op_stack, *(int8_t *) exec_res);
-                    }
-                    free(exec_res);
-                    /* method return string */
-                } else {
-                    void *exec_res = ptr_native_method(own_method, own_locals);
-                    create_string(clazz, (char *) exec_res);
-                    free(exec_res);
-                }
+                invoke_native(own_method, op_stack);
+                profile_allocations(clazz, method, pc);
             } else {
                 local_variable_t own_locals[own_method->code.max_locals];
+                memset(own_locals, 0, sizeof(own_locals));
                 for (int i = num_params - 1; i >= 0; i--) {
                     pop_to_local(op_stack, &own_locals[i]);
                 }
@@ -389,13 +678,10 @@ stack_entry_t *execute(method_t *method,
                 break;
             }
             case CONSTANT_String: {
-                char *src =
-                    (char *) get_constant(
-                        &constant_pool,
-                        ((CONSTANT_String_info *) info->info)->string_index)
-                        ->info;
-                char *dest = create_string(clazz, src);
-                push_ref(op_stack, dest);
+                push_ref(op_stack,
+                         resolve_string_constant(
+                             clazz, (CONSTANT_String_info *) info->info));
+                profile_allocations(clazz, method, pc);
                 break;
             }
             default:
@@ -532,10 +818,26 @@ stack_entry_t *execute(method_t *method,
             pc += 1;
         } break;
 
+        /* Convert int to byte */
+        case i_i2b: {
+            int32_t stored = pop_int(op_stack);
+            push_int(op_stack, (int8_t) stored);
+
+            pc += 1;
+        } break;
+
+        /* Convert int to short */
+        case i_i2s: {
+            int32_t stored = pop_int(op_stack);
+            push_int(op_stack, (int16_t) stored);
+
+            pc += 1;
+        } break;
+
         /* Convert int to char */
         case i_i2c: {
             int32_t stored = pop_int(op_stack);
-            push_byte(op_stack, (int8_t) stored);
+            push_int(op_stack, (u2) stored);
 
             pc += 1;
         } break;
@@ -640,10 +942,22 @@ stack_entry_t *execute(method_t *method,
         /* Load reference from array */
         case i_aaload: {
             int32_t index = pop_int(op_stack);
-            /* currently only support two dimension integer array */
-            int32_t **addr = pop_ref(op_stack);
+            ref_t *addr = pop_ref(op_stack);
+
+            check_index(addr, index);
+            push_ref(op_stack, decode_ref(addr[index]));
+            pc += 1;
+        } break;
+
+        /* Store into reference array */
+        case i_aastore: {
+            void *value = pop_ref(op_stack);
+            int32_t index = pop_int(op_stack);
+            ref_t *arr = pop_ref(op_stack);
 
-            push_ref(op_stack, addr[index]);
+            check_index(arr, index);
+            arr[index] = encode_ref(value);
+            write_barrier(arr, &arr[index], value);
             pc += 1;
         } break;
 
@@ -728,6 +1042,7 @@ stack_entry_t *execute(method_t *method,
                 method_t *method = find_method("<clinit>", "()V", new_clazz);
                 if (method) {
                     local_variable_t own_locals[method->code.max_locals];
+                    memset(own_locals, 0, sizeof(own_locals));
                     stack_entry_t *exec_res =
                         execute(method, own_locals, new_clazz);
                     assert(exec_res->type == STACK_ENTRY_NONE &&
@@ -854,6 +1169,7 @@ stack_entry_t *execute(method_t *method,
                 method_t *method = find_method("<clinit>", "()V", target_class);
                 if (method) {
                     local_variable_t own_locals[method->code.max_locals];
+                    memset(own_locals, 0, sizeof(own_locals));
                     stack_entry_t *exec_res =
                         execute(method, own_locals, target_class);
                     assert(exec_res->type == STACK_ENTRY_NONE &&
@@ -947,10 +1263,18 @@ stack_entry_t *execute(method_t *method,
                         field_descriptor[0]);
                 exit(1);
             }
+            if (field_descriptor[0] == 'L' || field_descriptor[0] == '[')
+                static_write_barrier(field->value->value.ptr_value);
 
             pc += 3;
         } break;
 
+        /* Push null */
+        case i_aconst_null: {
+            push_ref(op_stack, NULL);
+            pc += 1;
+        } break;
+
         /* Push int constant */
         case i_iconst_m1:
         case i_iconst_0:
@@ -1127,6 +1451,7 @@ stack_entry_t *execute(method_t *method,
                     var->value.ptr_value = addr;
                     var->type = VAR_PTR;
                 }
+                write_barrier(obj, &var->value.ptr_value, addr);
             } break;
             default:
                 assert(0 && "Only support integer, long and reference field");
@@ -1174,6 +1499,7 @@ stack_entry_t *execute(method_t *method,
                 method_t *method = find_method("<clinit>", "()V", new_class);
                 if (method) {
                     local_variable_t own_locals[method->code.max_locals];
+                    memset(own_locals, 0, sizeof(own_locals));
                     stack_entry_t *exec_res =
                         execute(method, own_locals, new_class);
                     assert(exec_res->type == STACK_ENTRY_NONE &&
@@ -1184,12 +1510,30 @@ stack_entry_t *execute(method_t *method,
                 free(tmp);
             }
 
-            object_t *object = create_object(new_class);
+            object_t *object;
+            u2 slot;
+            if (escape_analysis &&
+                allocate_in_frame(method, clazz, pc, &slot)) {
+                if (!frame->frame_objects[slot])
+                    frame->frame_objects[slot] =
+                        alloca(object_block_size(new_class));
+                object =
+                    init_frame_object(frame->frame_objects[slot], new_class);
+            } else {
+                object = create_object(new_class);
+                profile_allocations(clazz, method, pc);
+            }
             push_ref(op_stack, object);
 
             pc += 3;
         } break;
 
+        /* Discard the top operand stack value, such as an unused result */
+        case i_pop: {
+            op_stack->size--;
+            pc += 1;
+        } break;
+
         /* Duplicate the top operand stack value */
         case i_dup: {
             op_stack->store[op_stack->size] =
@@ -1225,77 +1569,15 @@ stack_entry_t *execute(method_t *method,
             uint8_t param1 = code_buf[pc + 1], param2 = code_buf[pc + 2];
             uint16_t index = ((param1 << 8) | param2);
 
-            bootstrap_methods_t *bootstrap_method =
-                find_bootstrap_method(index, clazz);
-
-            char *arg = NULL;
-            /* we only support makeConcatWithConstants (string concatenation),
-             * this mean argument must be only one string */
-            /* FIXME: if string contain '\0' character, it will cause error */
-            assert(bootstrap_method->num_bootstrap_arguments == 1 &&
-                   "only support makeConcatWithConstants");
-            for (int i = 0; i < bootstrap_method->num_bootstrap_arguments;
-                 ++i) {
-                arg = get_string_utf(&clazz->constant_pool,
-                                     bootstrap_method->bootstrap_arguments[i]);
-            }
-
-            /* each \u0001 mean "1" in unicode, this should be replace by actual
-             * argument from stack, others are constant characters */
-            uint16_t num_params = 0;
-            uint16_t num_constant = 0;
-            char *tmp = arg;
-            while (*tmp != '\0') {
-                if (*(tmp++) == 1) {
-                    num_params++;
-                }
-            }
-            num_constant = strlen(arg) - num_params;
-            char **all_string = malloc(sizeof(char *) * num_params);
-            size_t max_len = 0;
-            for (int i = 0; i < num_params; i++) {
-                stack_entry_t element = top(op_stack);
-                switch (element.type) {
-                /* integer */
-                case STACK_ENTRY_INT:
-                case STACK_ENTRY_SHORT:
-                case STACK_ENTRY_BYTE:
-                case STACK_ENTRY_LONG: {
-                    int64_t value = pop_int(op_stack);
-                    char str[50];
-                    snprintf(str, 50, "%ld", value);
-                    char *dest = create_string(clazz, str);
-                    all_string[i] = dest;
-                    break;
-                }
-                case STACK_ENTRY_REF: {
-                    all_string[i] = (char *) pop_ref(op_stack);
-                    break;
-                }
-                default: {
-                    printf("unknown stack top type (%d)\n", element.type);
-                    break;
-                }
-                }
-                max_len += strlen(all_string[i]);
-            }
-            max_len += num_constant;
-            char *new_str = calloc((max_len + 1), sizeof(char));
-
-            tmp = arg;
-            while (*tmp != '\0') {
-                if (*tmp == 1) {
-                    strcat(new_str, all_string[--num_params]);
-                } else {
-                    strncat(new_str, tmp, 1);
-                }
-                tmp++;
-            }
-            new_str[max_len] = '\0';
-            char *dest = create_string(clazz, new_str);
-            push_ref(op_stack, dest);
-            free(all_string);
-            free(new_str);
+            CONSTANT_InvokeDynamic_info *call_site =
+                (CONSTANT_InvokeDynamic_info *) get_constant(
+                    &clazz->constant_pool, index)
+                    ->info;
+            if (!call_site->recipe)
+                call_site->recipe = compile_concat_recipe(index, clazz);
+            push_ref(op_stack, concat_strings(call_site->recipe, op_stack,
+                                              clazz));
+            profile_allocations(clazz, method, pc);
 
             pc += 5;
 
@@ -1344,6 +1626,7 @@ stack_entry_t *execute(method_t *method,
                 method_t *method = find_method("<clinit>", "()V", target_class);
                 if (method) {
                     local_variable_t own_locals[method->code.max_locals];
+                    memset(own_locals, 0, sizeof(own_locals));
                     stack_entry_t *exec_res =
                         execute(method, own_locals, target_class);
                     assert(exec_res->type == STACK_ENTRY_NONE &&
@@ -1359,6 +1642,7 @@ stack_entry_t *execute(method_t *method,
                 find_method(method_name, method_descriptor, target_class);
             uint16_t num_params = get_number_of_parameters(constructor);
             local_variable_t own_locals[constructor->code.max_locals];
+            memset(own_locals, 0, sizeof(own_locals));
             for (int i = num_params; i >= 1; i--) {
                 pop_to_local(op_stack, &own_locals[i]);
             }
@@ -1419,6 +1703,7 @@ stack_entry_t *execute(method_t *method,
                 method_t *method = find_method("<clinit>", "()V", target_class);
                 if (method) {
                     local_variable_t own_locals[method->code.max_locals];
+                    memset(own_locals, 0, sizeof(own_locals));
                     stack_entry_t *exec_res =
                         execute(method, own_locals, target_class);
                     assert(exec_res->type == STACK_ENTRY_NONE &&
@@ -1429,51 +1714,15 @@ stack_entry_t *execute(method_t *method,
                 free(tmp);
             }
 
-            method_t *method =
+            method_t *own_method =
                 find_method(method_name, method_descriptor, target_class);
             uint16_t num_params;
-            if (method->access_flag & ACC_NATIVE) {
-                num_params = get_number_of_parameters(method);
-                /* FIXME: only support max 20 stack */
-                local_variable_t own_locals[20];
-                memset(own_locals, 0, sizeof(own_locals));
-                for (int i = num_params; i >= 1; i--) {
-                    pop_to_local(op_stack, &own_locals[i]);
-                }
-                object_t *obj = pop_ref(op_stack);
-
-                /* first argument is this pointer */
-                own_locals[0].entry.ptr_value = obj;
-                own_locals[0].type = STACK_ENTRY_REF;
-
-                /* method return void */
-                if (method_descriptor[strlen(method_descriptor) - 1] == 'V') {
-                    void_native_method(method, own_locals);
-                } else if (method_descriptor[strlen(method_descriptor) - 1] ==
-                           'J') {
-                    void *exec_res = ptr_native_method(method, own_locals);
-                    if (exec_res) {
-                        push_long(op_stack, *(int64_t *) exec_res);
-                    }
-                    free(exec_res);
-                } else if (method_descriptor[strlen(method_descriptor) - 1] ==
-                               'C' ||
-                           method_descriptor[strlen(method_descriptor) - 1] ==
-                               'I') {
-                    void *exec_res = ptr_native_method(method, own_locals);
-                    if (exec_res) {
-                        push_int(op_stack, *(int32_t *) exec_res);
-                    }
-                    free(exec_res);
-                } else {
-                    void *exec_res = ptr_native_method(method, own_locals);
-                    char *new_str = create_string(clazz, (char *) exec_res);
-                    push_ref(op_stack, new_str);
-                    free(exec_res);
-                }
+            if (own_method->access_flag & ACC_NATIVE) {
+                invoke_native(own_method, op_stack);
+                profile_allocations(clazz, method, pc);
             } else {
-                num_params = get_number_of_parameters(method);
-                local_variable_t own_locals[method->code.max_locals];
+                num_params = get_number_of_parameters(own_method);
+                local_variable_t own_locals[own_method->code.max_locals];
                 memset(own_locals, 0, sizeof(own_locals));
                 for (int i = num_params; i >= 1; i--) {
                     pop_to_local(op_stack, &own_locals[i]);
@@ -1485,7 +1734,7 @@ stack_entry_t *execute(method_t *method,
                 own_locals[0].type = STACK_ENTRY_REF;
 
                 stack_entry_t *exec_res =
-                    execute(method, own_locals, target_class);
+                    execute(own_method, own_locals, target_class);
                 switch (exec_res->type) {
                 case STACK_ENTRY_INT: {
                     push_int(op_stack, exec_res->entry.int_value);
@@ -1510,44 +1759,146 @@ stack_entry_t *execute(method_t *method,
         /* Load int from array */
         case i_iaload: {
             int idx = pop_int(op_stack);
-            int *arr = pop_ref(op_stack);
+            int32_t *arr = pop_ref(op_stack);
 
+            check_index(arr, idx);
             push_int(op_stack, arr[idx]);
             pc += 1;
         } break;
 
+        /* Load long from array */
+        case i_laload: {
+            int idx = pop_int(op_stack);
+            int64_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            push_long(op_stack, arr[idx]);
+            pc += 1;
+        } break;
+
+        /* Load byte or boolean from array */
+        case i_baload: {
+            int idx = pop_int(op_stack);
+            int8_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            push_int(op_stack, arr[idx]);
+            pc += 1;
+        } break;
+
+        /* Load char from array */
+        case i_caload: {
+            int idx = pop_int(op_stack);
+            u2 *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            push_int(op_stack, arr[idx]);
+            pc += 1;
+        } break;
+
+        /* Load short from array */
+        case i_saload: {
+            int idx = pop_int(op_stack);
+            int16_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            push_int(op_stack, arr[idx]);
+            pc += 1;
+        } break;
+
+        /* Load float or double from array, there is no floating point
+         * arithmetic yet, so they are moved as their bits */
+        case i_faload: {
+            int idx = pop_int(op_stack);
+            int32_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            push_int(op_stack, arr[idx]);
+            pc += 1;
+        } break;
+
+        case i_daload: {
+            int idx = pop_int(op_stack);
+            int64_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            push_long(op_stack, arr[idx]);
+            pc += 1;
+        } break;
+
         /* Store into int array */
-        case i_iastore: {
+        case i_iastore:
+        case i_fastore: {
             int value = pop_int(op_stack);
             int idx = pop_int(op_stack);
-            int *arr = pop_ref(op_stack);
+            int32_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            arr[idx] = value;
+            pc += 1;
+        } break;
+
+        /* Store into long array */
+        case i_lastore:
+        case i_dastore: {
+            int64_t value = pop_int(op_stack);
+            int idx = pop_int(op_stack);
+            int64_t *arr = pop_ref(op_stack);
 
+            check_index(arr, idx);
             arr[idx] = value;
             pc += 1;
         } break;
 
+        /* Store into byte or boolean array */
+        case i_bastore: {
+            int value = pop_int(op_stack);
+            int idx = pop_int(op_stack);
+            int8_t *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            arr[idx] = (int8_t) value;
+            pc += 1;
+        } break;
+
+        /* Store into char or short array */
+        case i_castore:
+        case i_sastore: {
+            int value = pop_int(op_stack);
+            int idx = pop_int(op_stack);
+            u2 *arr = pop_ref(op_stack);
+
+            check_index(arr, idx);
+            arr[idx] = (u2) value;
+            pc += 1;
+        } break;
+
+        /* Get length of array */
+        case i_arraylength: {
+            void *arr = pop_ref(op_stack);
+            check_null(arr);
+            push_int(op_stack, header_of(arr)->length);
+            pc += 1;
+        } break;
+
+        /* Create new array of reference */
+        case i_anewarray: {
+            int count = pop_int(op_stack);
+            check_array_size(count);
+            push_ref(op_stack, create_reference_array(count));
+            profile_allocations(clazz, method, pc);
+            pc += 3;
+        } break;
+
         /* Create new array */
         case i_newarray: {
-            uint8_t index = code_buf[pc + 1];
-
+            uint8_t type = code_buf[pc + 1];
             int count = pop_int(op_stack);
-            void *arr = NULL;
-            switch (index) {
-            case T_INT: {
-                arr = create_array(clazz, count);
-            } break;
-            case T_BOOLEN:
-            case T_CHAR:
-            case T_FLOAT:
-            case T_DOUBLE:
-            case T_BYTE:
-            case T_SHORT:
-            case T_LONG:
-            default:
-                assert(0 && "only support int array");
-                break;
-            }
-            push_ref(op_stack, arr);
+
+            assert(type >= T_BOOLEN && type <= T_LONG && "Unknown array type");
+            check_array_size(count);
+            push_ref(op_stack, create_array(clazz, type, count));
+            profile_allocations(clazz, method, pc);
             pc += 2;
         } break;
 
@@ -1562,12 +1913,16 @@ stack_entry_t *execute(method_t *method,
                               get_class_name(&clazz->constant_pool, index)
                                   ->string_index))
                     ->info;
-            assert(dimensions == 2 && strcmp(type, "[[I") == 0 &&
-                   "this VM only support two dimension integer array");
 
-            int32_t x = pop_int(op_stack), y = pop_int(op_stack);
-            void **arr = create_two_dimension_array(clazz, x, y);
-            push_ref(op_stack, arr);
+            /* the count of the last dimension is on top */
+            int32_t counts[dimensions];
+            for (int i = dimensions - 1; i >= 0; i--) {
+                counts[i] = pop_int(op_stack);
+                check_array_size(counts[i]);
+            }
+            push_ref(op_stack,
+                     create_multi_array(clazz, type, dimensions, counts));
+            profile_allocations(clazz, method, pc);
             pc += 4;
         } break;
         }
@@ -1575,14 +1930,146 @@ stack_entry_t *execute(method_t *method,
     return NULL;
 }
 
+/**
+ * Execute the opcode instructions of a method until it returns.
+ *
+ * @param method the method to run
+ * @param locals the array of local variables, including the method parameters.
+ *               Except for parameters, the locals must be cleared, as the
+ *               collector scans all of them for references.
+ * @param clazz the class file the method belongs to
+ * @return the method return variable, a heap-allocated pointer, should be free
+ * from caller;
+ *
+ */
+stack_entry_t *execute(method_t *method,
+                       local_variable_t *locals,
+                       class_file_t *clazz)
+{
+    frame_t frame = {
+        .method = method,
+        .clazz = clazz,
+        .pc = 0,
+        .locals = locals,
+        .max_locals = method->code.max_locals,
+        .op_stack = NULL,
+        .frame_objects = NULL,
+        .frame_object_count = 0,
+        .prev = current_frame,
+    };
+    /* the profiler may walk the frames from any instruction */
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    current_frame = &frame;
+    method_calls++;
+    u8 start = trace_now();
+    stack_entry_t *ret = interpret(method, locals, clazz, &frame);
+    if (tracing)
+        trace_method(method, clazz, start);
+    current_frame = frame.prev;
+    return ret;
+}
+
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    bool use_writev = false;
+    size_t max_heap = GC_DEFAULT_MAX_HEAP;
+    size_t nursery_size = NURSERY_SIZE;
+
+    /* VM options precede the class file */
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-Xwritev") == 0) {
+            use_writev = true;
+        } else if (strncmp(argv[arg], "-Xmx", 4) == 0) {
+            if (!parse_heap_size(argv[arg] + 4, &max_heap)) {
+                fprintf(stderr, "Invalid heap size %s\n", argv[arg]);
+                return -1;
+            }
+        } else if (strncmp(argv[arg], "-Xmn", 4) == 0) {
+            if (!parse_heap_size(argv[arg] + 4, &nursery_size)) {
+                fprintf(stderr, "Invalid nursery size %s\n", argv[arg]);
+                return -1;
+            }
+        } else if (strncmp(argv[arg], "-XX:ParallelGCThreads=", 22) == 0) {
+            char *end;
+            gc_threads = strtol(argv[arg] + 22, &end, 10);
+            if (end == argv[arg] + 22 || *end || gc_threads <= 0) {
+                fprintf(stderr, "Invalid thread count %s\n", argv[arg]);
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "-XX:+HeapDumpAtExit") == 0) {
+            heap_dump_at_exit = true;
+        } else if (strncmp(argv[arg], "-XX:HeapDumpPath=", 17) == 0) {
+            heap_dump_path = argv[arg] + 17;
+        } else if (strcmp(argv[arg], "-XX:+ProfileAllocations") == 0) {
+            allocation_profiling = true;
+        } else if (strncmp(argv[arg], "-XX:AllocationSampleInterval=", 29) ==
+                   0) {
+            if (!parse_heap_size(argv[arg] + 29,
+                                 &allocation_sample_interval) ||
+                !allocation_sample_interval) {
+                fprintf(stderr, "Invalid sample interval %s\n", argv[arg]);
+                return -1;
+            }
+        } else if (strncmp(argv[arg], "-XX:AllocationProfilePath=", 26) == 0) {
+            allocation_profile_path = argv[arg] + 26;
+            allocation_profiling = true;
+        } else if (strcmp(argv[arg], "-XX:+ProfileCPU") == 0) {
+            cpu_profiling = true;
+        } else if (strncmp(argv[arg], "-XX:CPUSampleRate=", 18) == 0) {
+            char *end;
+            cpu_sample_rate = strtol(argv[arg] + 18, &end, 10);
+            if (end == argv[arg] + 18 || *end || cpu_sample_rate <= 0 ||
+                cpu_sample_rate > 1000000) {
+                fprintf(stderr, "Invalid sample rate %s\n", argv[arg]);
+                return -1;
+            }
+        } else if (strncmp(argv[arg], "-XX:CPUProfilePath=", 19) == 0) {
+            cpu_profile_path = argv[arg] + 19;
+            cpu_profiling = true;
+        } else if (strcmp(argv[arg], "-XX:+TraceEvents") == 0) {
+            tracing = true;
+        } else if (strncmp(argv[arg], "-XX:TraceEventPath=", 19) == 0) {
+            trace_path = argv[arg] + 19;
+            tracing = true;
+        } else if (strncmp(argv[arg], "-XX:TraceMethodThreshold=", 25) == 0) {
+            char *end;
+            trace_method_threshold_us = strtol(argv[arg] + 25, &end, 10);
+            if (end == argv[arg] + 25 || *end ||
+                trace_method_threshold_us < 0) {
+                fprintf(stderr, "Invalid threshold %s\n", argv[arg]);
+                return -1;
+            }
+        } else if (strcmp(argv[arg], "-XX:-DoEscapeAnalysis") == 0) {
+            escape_analysis = false;
+        } else if (strcmp(argv[arg], "-Xstats") == 0) {
+            vm_stats = true;
+        } else if (strcmp(argv[arg], "-verbose:gc") == 0) {
+            gc_verbose = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (arg >= argc)
         return -1;
+    char *class_path = argv[arg];
+
+#ifdef COMPRESSED_REFS
+    if (max_heap > COMPRESSED_HEAP_LIMIT) {
+        fprintf(stderr, "Heap size above 32g needs uncompressed references\n");
+        return -1;
+    }
+#endif
+
+    init_vm_stats();
+    init_output(use_writev);
+    init_heap_dump();
+    init_trace();
 
     /* attempt to read given class file */
-    FILE *class_file = fopen(argv[1], "r");
+    FILE *class_file = fopen(class_path, "r");
     assert(class_file && "Failed to open file");
 
     /* parse the class file */
@@ -1593,15 +2080,20 @@ int main(int argc, char *argv[])
     assert(!error && "Failed to close file");
 
     init_class_heap();
-    init_object_heap();
+    init_object_heap(max_heap, nursery_size);
+    init_allocation_profile();
+    start_cpu_profile();
+    enter_phase(PHASE_BOOTSTRAP_LOAD);
     load_native_class("java");
 
     /* native class clinit */
+    enter_phase(PHASE_BOOTSTRAP_CLINIT);
     for (int i = 0; i < class_heap.length; ++i) {
         method_t *method =
             find_method("<clinit>", "()V", class_heap.class_info[i]->clazz);
         if (method) {
             local_variable_t own_locals[method->code.max_locals];
+            memset(own_locals, 0, sizeof(own_locals));
             stack_entry_t *exec_res =
                 execute(method, own_locals, class_heap.class_info[i]->clazz);
             assert(exec_res->type == STACK_ENTRY_NONE &&
@@ -1610,21 +2102,23 @@ int main(int argc, char *argv[])
         }
     }
 
-    char *match = strrchr(argv[1], '/');
+    char *match = strrchr(class_path, '/');
     if (match == NULL) {
-        add_class(clazz, argv[1]);
+        add_class(clazz, class_path);
         prefix = malloc(1 * sizeof(char));
         prefix[0] = '\0';
     } else {
-        add_class(clazz, argv[1]);
-        prefix = malloc((match - argv[1] + 2) * sizeof(char));
-        strncpy(prefix, argv[1], match - argv[1] + 1);
-        prefix[match - argv[1] + 1] = '\0';
+        add_class(clazz, class_path);
+        prefix = malloc((match - class_path + 2) * sizeof(char));
+        strncpy(prefix, class_path, match - class_path + 1);
+        prefix[match - class_path + 1] = '\0';
     }
 
+    enter_phase(PHASE_INTERPRETER);
     method_t *method = find_method("<clinit>", "()V", clazz);
     if (method) {
         local_variable_t own_locals[method->code.max_locals];
+        memset(own_locals, 0, sizeof(own_locals));
         stack_entry_t *exec_res = execute(method, own_locals, clazz);
         assert(exec_res->type == STACK_ENTRY_NONE &&
                "<clinit> must be no return");
@@ -1645,10 +2139,32 @@ int main(int argc, char *argv[])
     stack_entry_t *result = execute(main_method, locals, clazz);
     assert(result->type == STACK_ENTRY_NONE && "main() should return void");
     free(result);
-
+    enter_phase(PHASE_OTHER);
+    stop_cpu_profile();
+    report_allocation_profile();
+#ifdef OPCODE_STATS
+    report_opcode_stats();
+#endif
+    if (heap_dump_at_exit)
+        dump_heap();
+    write_trace();
+
+    output_flush();
+
+    int classes = class_heap.length;
+    enter_phase(PHASE_TEARDOWN);
+    free_input();
     free(prefix);
+    free_intern_table();
     free_object_heap();
+    free_allocation_profile();
+#ifdef OPCODE_STATS
+    free_opcode_stats();
+#endif
+    free_cpu_profile();
+    free_trace();
     free_class_heap();
+    report_vm_stats(classes);
 
     return 0;
 }
@@ -1,86 +1,509 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "native.h"
+#include "class_heap.h"
+#include "gc.h"
+#include "heap_dump.h"
+#include "io_buffer.h"
+#include "object_heap.h"
 
-/* not check class type yet */
-void void_native_method(method_t *method, local_variable_t *locals)
-{
-    if (strcmp(method->name, "println") == 0) {
-        if (strcmp(method->descriptor, "()V") == 0) {
-            printf("\n");
-        } else if (strcmp(method->descriptor, "(I)V") == 0) {
-            int32_t value = stack_to_int(&locals[1].entry, sizeof(int32_t));
-            printf("%d\n", value);
-        } else if (strcmp(method->descriptor, "(Ljava/lang/String;)V") == 0) {
-            void *addr = locals[1].entry.ptr_value;
-            printf("%s\n", (char *) addr);
-        }
-    } else if (strcmp(method->name, "print") == 0) {
-        if (strcmp(method->descriptor, "(Ljava/lang/String;)V") == 0) {
-            void *addr = locals[1].entry.ptr_value;
-            printf("%s", (char *) addr);
-        }
-    } else if (strcmp(method->name, "flush") == 0) {
-        if (strcmp(method->descriptor, "()V") == 0) {
-            fflush(stdout);
+/* there is no exception handling, an exception ends the program */
+void throw_exception(const char *message)
+{
+    fprintf(stderr, "Exception in thread \"main\" java.lang.%s\n", message);
+    exit(1);
+}
+
+/* read an integral argument whatever width it was pushed with */
+static inline int64_t arg_int(stack_entry_t *args, int i)
+{
+    return stack_to_int(&args[i].entry, get_type_size(args[i].type));
+}
+
+static class_file_t *string_class()
+{
+    static class_file_t *clazz = NULL;
+    if (!clazz)
+        clazz = find_class_from_heap("java/lang/String");
+    return clazz;
+}
+
+static stack_value_t native_print_newline(stack_entry_t *args)
+{
+    (void) args;
+    output_char('\n');
+    return (stack_value_t){0};
+}
+
+static stack_value_t native_println_int(stack_entry_t *args)
+{
+    int32_t value = arg_int(args, 1);
+    output_long(value);
+    output_char('\n');
+    return (stack_value_t){0};
+}
+
+static void output_string(string_t *str)
+{
+    if (str)
+        output_chars(str->value, str->length, str->coder);
+    else
+        output_write("null", 4);
+}
+
+static stack_value_t native_println_string(stack_entry_t *args)
+{
+    output_string(args[1].entry.ptr_value);
+    output_char('\n');
+    return (stack_value_t){0};
+}
+
+static stack_value_t native_print_string(stack_entry_t *args)
+{
+    output_string(args[1].entry.ptr_value);
+    return (stack_value_t){0};
+}
+
+static stack_value_t native_flush(stack_entry_t *args)
+{
+    (void) args;
+    output_flush();
+    return (stack_value_t){0};
+}
+
+/* return the next line of standard input decoded as UTF-8, or null at end of
+ * stream */
+static stack_value_t native_read_line(stack_entry_t *args)
+{
+    (void) args;
+    const char *line;
+    size_t len;
+    if (!input_read_line(&line, &len))
+        return (stack_value_t){.ptr_value = NULL};
+    return (stack_value_t){
+        .ptr_value = create_string_from_utf8(string_class(), line, len)};
+}
+
+/* NumberFormatException of Long.parseLong(), quoting the string in UTF-8 */
+static void number_format_exception(string_t *str)
+{
+    if (!str)
+        throw_exception(
+            "NumberFormatException: Cannot parse null string: null");
+    static const char prefix[] = "NumberFormatException: For input string: \"";
+    char *message = malloc(sizeof(prefix) + 3 * (size_t) str->length + 1);
+    assert(message && "Failed to allocate exception message");
+    size_t len = sizeof(prefix) - 1;
+    memcpy(message, prefix, len);
+    for (u4 i = 0; i < str->length; i++) {
+        u2 c = string_char_at(str, i);
+        if (c < 0x80) {
+            message[len++] = c;
+        } else if (c < 0x800) {
+            message[len++] = 0xC0 | c >> 6;
+            message[len++] = 0x80 | (c & 0x3F);
+        } else {
+            message[len++] = 0xE0 | c >> 12;
+            message[len++] = 0x80 | (c >> 6 & 0x3F);
+            message[len++] = 0x80 | (c & 0x3F);
         }
     }
+    message[len++] = '"';
+    message[len] = '\0';
+    throw_exception(message);
 }
 
-void *ptr_native_method(method_t *method, local_variable_t *locals)
+/* Long.parseLong(), an optional sign then decimal digits only */
+static stack_value_t native_parse_long(stack_entry_t *args)
 {
-    if (strcmp(method->name, "readLine") == 0) {
-        if (strcmp(method->descriptor, "()Ljava/lang/String;") == 0) {
-            char *str = malloc(sizeof(char) * 50);
-            int ret = scanf("%50s", str);
-            assert(ret > 0 && "scanf error");
-            return str;
-        }
-    } else if (strcmp(method->name, "parseLong") == 0) {
-        if (strcmp(method->descriptor, "(Ljava/lang/String;)J") == 0) {
-            void *addr = locals[1].entry.ptr_value;
-            long *value = malloc(sizeof(long));
-            *value = atoll((char *) addr);
-            return value;
-        }
-    } else if (strcmp(method->name, "currentTimeMillis") == 0) {
-        if (strcmp(method->descriptor, "()J") == 0) {
-            struct timeval time;
-            gettimeofday(&time, NULL);
-            int64_t s1 = (int64_t)(time.tv_sec) * 1000;
-            int64_t s2 = (time.tv_usec / 1000);
-            long *value = malloc(sizeof(long));
-            *value = s1 + s2;
-            return value;
-        }
-    } else if (strcmp(method->name, "charAt") == 0) {
-        if (strcmp(method->descriptor, "(I)C") == 0) {
-            char *str = locals[0].entry.ptr_value;
-            char *c = malloc(sizeof(char));
-            int32_t index = stack_to_int(&locals[1].entry, sizeof(int32_t));
-            *c = str[index];
-            return c;
+    string_t *str = args[0].entry.ptr_value;
+    if (!str || !str->length)
+        number_format_exception(str);
+    u4 i = 0;
+    bool negative = false;
+    u2 c = string_char_at(str, 0);
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        if (++i == str->length)
+            number_format_exception(str);
+    }
+    /* accumulate negatively, as INT64_MIN has no positive counterpart */
+    int64_t value = 0;
+    for (; i < str->length; i++) {
+        c = string_char_at(str, i);
+        if (c < '0' || c > '9')
+            number_format_exception(str);
+        int digit = c - '0';
+        if (value < (INT64_MIN + digit) / 10)
+            number_format_exception(str);
+        value = value * 10 - digit;
+    }
+    if (!negative) {
+        if (value == INT64_MIN)
+            number_format_exception(str);
+        value = -value;
+    }
+    return (stack_value_t){.long_value = value};
+}
+
+static stack_value_t native_current_time_millis(stack_entry_t *args)
+{
+    (void) args;
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    int64_t s1 = (int64_t)(time.tv_sec) * 1000;
+    int64_t s2 = (time.tv_usec / 1000);
+    return (stack_value_t){.long_value = s1 + s2};
+}
+
+/* the collection runs at the safepoint right after this call */
+static stack_value_t native_gc(stack_entry_t *args)
+{
+    (void) args;
+    gc_requested = gc_full = true;
+    return (stack_value_t){0};
+}
+
+/* the path of System.dumpHeap() as a C string, encoded as UTF-8 */
+static char *path_of(string_t *str)
+{
+    char *path = malloc(str->length * 3 + 1), *p = path;
+    assert(path && "Failed to allocate path");
+    for (u4 i = 0; i < str->length; i++) {
+        u2 c = string_char_at(str, i);
+        if (c < 0x80) {
+            *p++ = c;
+        } else if (c < 0x800) {
+            *p++ = 0xC0 | c >> 6;
+            *p++ = 0x80 | (c & 0x3F);
+        } else {
+            *p++ = 0xE0 | c >> 12;
+            *p++ = 0x80 | (c >> 6 & 0x3F);
+            *p++ = 0x80 | (c & 0x3F);
         }
-    } else if (strcmp(method->name, "compareTo") == 0) {
-        if (strcmp(method->descriptor, "(Ljava/lang/String;)I") == 0) {
-            char *str = locals[0].entry.ptr_value;
-            char *str2 = locals[1].entry.ptr_value;
-
-            size_t l1 = strlen(str), l2 = strlen(str2);
-            int idx = 0;
-            int result;
-
-            int end = (l1 < l2 ? l1 : l2);
-            int32_t *ret = malloc(sizeof(int32_t));
-
-            while (idx < end) {
-                if ((result = str[idx] - str2[idx]) != 0) {
-                    *ret = result;
-                    return ret;
-                }
-                idx++;
-            }
-            *ret = result;
-            return ret;
+    }
+    *p = '\0';
+    return path;
+}
+
+/* the dump is written at the safepoint right after this call */
+static stack_value_t native_dump_heap(stack_entry_t *args)
+{
+    request_heap_dump(path_of(args[0].entry.ptr_value));
+    return (stack_value_t){0};
+}
+
+static stack_value_t native_char_at(stack_entry_t *args)
+{
+    string_t *str = args[0].entry.ptr_value;
+    int32_t index = arg_int(args, 1);
+    return (stack_value_t){.int_value = string_char_at(str, index)};
+}
+
+static stack_value_t native_length(stack_entry_t *args)
+{
+    string_t *str = args[0].entry.ptr_value;
+    return (stack_value_t){.int_value = str->length};
+}
+
+static stack_value_t native_compare_to(stack_entry_t *args)
+{
+    return (stack_value_t){
+        .int_value = string_compare(args[0].entry.ptr_value,
+                                    args[1].entry.ptr_value)};
+}
+
+static stack_value_t native_index_of_char(stack_entry_t *args)
+{
+    string_t *str = args[0].entry.ptr_value;
+    return (stack_value_t){
+        .int_value = string_index_of_char(str, arg_int(args, 1))};
+}
+
+static stack_value_t native_index_of(stack_entry_t *args)
+{
+    return (stack_value_t){
+        .int_value =
+            string_index_of(args[0].entry.ptr_value, args[1].entry.ptr_value)};
+}
+
+static stack_value_t native_hash_code(stack_entry_t *args)
+{
+    string_t *str = args[0].entry.ptr_value;
+    return (stack_value_t){.int_value = string_hash(str)};
+}
+
+static stack_value_t native_intern(stack_entry_t *args)
+{
+    string_t *str = args[0].entry.ptr_value;
+    string_t *interned = intern_string(str);
+    /* the intern table is only scanned by minor collections when needed */
+    if (interned == str && is_young(str))
+        object_heap.young_interned = true;
+    return (stack_value_t){.ptr_value = interned};
+}
+
+/* String.equals(Object), false for anything but a string */
+static stack_value_t native_equals(stack_entry_t *args)
+{
+    void *other = args[1].entry.ptr_value;
+    if (!other || header_of(other)->kind != OBJECT_STRING)
+        return (stack_value_t){.int_value = false};
+    return (stack_value_t){
+        .int_value = string_equals(args[0].entry.ptr_value, other)};
+}
+
+/**
+ * A StringBuilder keeps its characters in a String used as a buffer, whose
+ * length is the capacity, and counts how many of them are in use. The buffer
+ * doubles whenever it is too small, so appending is amortized O(1).
+ */
+static variable_t *builder_field(object_t *builder, char *name)
+{
+    variable_t *field = find_field_addr(builder, name);
+    assert(field && "StringBuilder is missing a field");
+    return field;
+}
+
+/* make room for extra more characters in at least the given coder, and
+ * return where to write them */
+static char *builder_reserve(object_t *builder, size_t extra, u1 *coder)
+{
+    variable_t *value = builder_field(builder, "value");
+    variable_t *count = builder_field(builder, "count");
+    string_t *buffer = value->type == VAR_STR_PTR ? value->value.ptr_value
+                                                  : NULL;
+    size_t used = count->value.int_value;
+    size_t needed = used + extra;
+    u1 new_coder = buffer && buffer->coder > *coder ? buffer->coder : *coder;
+
+    if (!buffer || needed > buffer->length || new_coder != buffer->coder) {
+        size_t capacity = buffer ? buffer->length : 0;
+        if (capacity < STRING_BUILDER_CAPACITY)
+            capacity = STRING_BUILDER_CAPACITY;
+        while (capacity < needed)
+            capacity *= 2;
+        string_t *grown = alloc_string(string_class(), capacity, new_coder);
+        if (buffer)
+            copy_chars(grown->value, new_coder, buffer->value, buffer->coder,
+                       used);
+        value->value.ptr_value = buffer = grown;
+        value->type = VAR_STR_PTR;
+        write_barrier(builder, &value->value.ptr_value, grown);
+    }
+    count->value.int_value = needed;
+    count->type = VAR_INT;
+    *coder = buffer->coder;
+    return buffer->value + string_size(used, buffer->coder);
+}
+
+static void builder_append_latin1(object_t *builder,
+                                  const char *src,
+                                  size_t len)
+{
+    u1 coder = STRING_LATIN1;
+    char *out = builder_reserve(builder, len, &coder);
+    copy_chars(out, coder, src, STRING_LATIN1, len);
+}
+
+static stack_value_t native_append_string(stack_entry_t *args)
+{
+    object_t *builder = args[0].entry.ptr_value;
+    string_t *str = args[1].entry.ptr_value;
+    if (!str) {
+        builder_append_latin1(builder, "null", 4);
+    } else {
+        u1 coder = str->coder;
+        char *out = builder_reserve(builder, str->length, &coder);
+        copy_chars(out, coder, str->value, str->coder, str->length);
+    }
+    return (stack_value_t){.ptr_value = builder};
+}
+
+static stack_value_t native_append_char(stack_entry_t *args)
+{
+    object_t *builder = args[0].entry.ptr_value;
+    u2 c = arg_int(args, 1);
+    u1 coder = c > 0xFF ? STRING_UTF16 : STRING_LATIN1;
+    char *out = builder_reserve(builder, 1, &coder);
+    if (coder == STRING_LATIN1)
+        *out = (char) c;
+    else
+        memcpy(out, &c, sizeof(c));
+    return (stack_value_t){.ptr_value = builder};
+}
+
+/* append(int) and append(long) */
+static stack_value_t native_append_long(stack_entry_t *args)
+{
+    object_t *builder = args[0].entry.ptr_value;
+    char buf[24];
+    builder_append_latin1(builder, buf, format_decimal(arg_int(args, 1), buf));
+    return (stack_value_t){.ptr_value = builder};
+}
+
+/* growing pads with '\u0000' */
+static stack_value_t native_set_length(stack_entry_t *args)
+{
+    object_t *builder = args[0].entry.ptr_value;
+    int32_t length = arg_int(args, 1);
+    assert(length >= 0 && "StringBuilder length must not be negative");
+
+    variable_t *count = builder_field(builder, "count");
+    if ((u4) length <= count->value.int_value) {
+        count->value.int_value = length;
+    } else {
+        u1 coder = STRING_LATIN1;
+        size_t extra = length - count->value.int_value;
+        char *out = builder_reserve(builder, extra, &coder);
+        memset(out, 0, string_size(extra, coder));
+    }
+    return (stack_value_t){0};
+}
+
+/* copy the used part of the buffer into a single exactly sized string */
+static stack_value_t native_builder_to_string(stack_entry_t *args)
+{
+    object_t *builder = args[0].entry.ptr_value;
+    variable_t *value = builder_field(builder, "value");
+    size_t used = builder_field(builder, "count")->value.int_value;
+    if (value->type != VAR_STR_PTR || used == 0)
+        return (stack_value_t){
+            .ptr_value = alloc_string(string_class(), 0, STRING_LATIN1)};
+
+    string_t *buffer = value->value.ptr_value;
+    /* a shortened buffer may no longer need UTF-16 */
+    u1 coder = narrowest_coder(buffer->value, used, buffer->coder);
+    string_t *str = alloc_string(string_class(), used, coder);
+    copy_chars(str->value, coder, buffer->value, buffer->coder, used);
+    return (stack_value_t){.ptr_value = str};
+}
+
+typedef struct {
+    const char *class_name;
+    const char *name;
+    const char *descriptor;
+    native_method_t func;
+} native_entry_t;
+
+/* every native method known to the VM; adding a native only needs a new
+ * entry here */
+static const native_entry_t native_registry[] = {
+    {"java/io/PrintStream", "print", "(Ljava/lang/String;)V",
+     native_print_string},
+    {"java/io/PrintStream", "println", "()V", native_print_newline},
+    {"java/io/PrintStream", "println", "(I)V", native_println_int},
+    {"java/io/PrintStream", "println", "(Ljava/lang/String;)V",
+     native_println_string},
+    {"java/io/PrintStream", "flush", "()V", native_flush},
+    {"java/io/BufferedReader", "readLine", "()Ljava/lang/String;",
+     native_read_line},
+    {"java/lang/Long", "parseLong", "(Ljava/lang/String;)J",
+     native_parse_long},
+    {"java/lang/System", "currentTimeMillis", "()J",
+     native_current_time_millis},
+    {"java/lang/System", "gc", "()V", native_gc},
+    {"java/lang/System", "dumpHeap", "(Ljava/lang/String;)V",
+     native_dump_heap},
+    {"java/lang/String", "charAt", "(I)C", native_char_at},
+    {"java/lang/String", "length", "()I", native_length},
+    {"java/lang/String", "compareTo", "(Ljava/lang/String;)I",
+     native_compare_to},
+    {"java/lang/String", "indexOf", "(I)I", native_index_of_char},
+    {"java/lang/String", "indexOf", "(Ljava/lang/String;)I", native_index_of},
+    {"java/lang/String", "hashCode", "()I", native_hash_code},
+    {"java/lang/String", "equals", "(Ljava/lang/Object;)Z", native_equals},
+    {"java/lang/String", "intern", "()Ljava/lang/String;", native_intern},
+    {"java/lang/StringBuilder", "append",
+     "(Ljava/lang/String;)Ljava/lang/StringBuilder;", native_append_string},
+    {"java/lang/StringBuilder", "append", "(C)Ljava/lang/StringBuilder;",
+     native_append_char},
+    {"java/lang/StringBuilder", "append", "(I)Ljava/lang/StringBuilder;",
+     native_append_long},
+    {"java/lang/StringBuilder", "append", "(J)Ljava/lang/StringBuilder;",
+     native_append_long},
+    {"java/lang/StringBuilder", "setLength", "(I)V", native_set_length},
+    {"java/lang/StringBuilder", "toString", "()Ljava/lang/String;",
+     native_builder_to_string},
+};
+
+#define NATIVE_REGISTRY_SIZE \
+    (sizeof(native_registry) / sizeof(native_registry[0]))
+
+/* open addressing table, must be a power of two and at least twice the size
+ * of native_registry */
+#define NATIVE_TABLE_SIZE 64
+
+static const native_entry_t *native_table[NATIVE_TABLE_SIZE];
+static bool native_table_ready = false;
+
+/* FNV-1a over "class\0name\0descriptor" */
+static uint32_t native_hash(const char *class_name,
+                            const char *name,
+                            const char *descriptor)
+{
+    const char *keys[3] = {class_name, name, descriptor};
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 3; i++) {
+        for (const char *c = keys[i]; *c; c++) {
+            hash ^= (u1) *c;
+            hash *= 16777619u;
         }
+        /* separate the keys so "ab" + "c" differs from "a" + "bc" */
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void init_native_table()
+{
+    for (size_t i = 0; i < NATIVE_REGISTRY_SIZE; i++) {
+        const native_entry_t *entry = &native_registry[i];
+        uint32_t slot = native_hash(entry->class_name, entry->name,
+                                    entry->descriptor) &
+                        (NATIVE_TABLE_SIZE - 1);
+        while (native_table[slot])
+            slot = (slot + 1) & (NATIVE_TABLE_SIZE - 1);
+        native_table[slot] = entry;
+    }
+    native_table_ready = true;
+}
+
+native_method_t find_native_method(const char *class_name,
+                                   const char *name,
+                                   const char *descriptor)
+{
+    if (!native_table_ready)
+        init_native_table();
+
+    uint32_t slot =
+        native_hash(class_name, name, descriptor) & (NATIVE_TABLE_SIZE - 1);
+    while (native_table[slot]) {
+        const native_entry_t *entry = native_table[slot];
+        if (!(strcmp(entry->class_name, class_name) ||
+              strcmp(entry->name, name) ||
+              strcmp(entry->descriptor, descriptor)))
+            return entry->func;
+        slot = (slot + 1) & (NATIVE_TABLE_SIZE - 1);
     }
     return NULL;
-}
\ No newline at end of file
+}
+
+/* bind every ACC_NATIVE method of a newly loaded class to its C function,
+ * and record how many operand stack slots it consumes and what it returns */
+void bind_native_methods(class_file_t *clazz, const char *class_name)
+{
+    for (method_t *method = clazz->methods; method->name; method++) {
+        if (!(method->access_flag & ACC_NATIVE))
+            continue;
+        method->native_method =
+            find_native_method(class_name, method->name, method->descriptor);
+        method->native_argc = get_number_of_parameters(method);
+        if (!(method->access_flag & ACC_STATIC))
+            method->native_argc++;
+        method->native_return = strchr(method->descriptor, ')')[1];
+    }
+}
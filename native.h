@@ -4,5 +4,8 @@
 #include "java_file.h"
 #include "stack.h"
 
-void void_native_method(method_t *method, local_variable_t *locals);
-void *ptr_native_method(method_t *method, local_variable_t *locals);
\ No newline at end of file
+native_method_t find_native_method(const char *class_name,
+                                   const char *name,
+                                   const char *descriptor);
+void bind_native_methods(class_file_t *clazz, const char *class_name);
+void throw_exception(const char *message);
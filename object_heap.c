@@ -1,96 +1,566 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS and madvise() */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gc.h"
 #include "object_heap.h"
 
-void init_object_heap()
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+object_heap_t object_heap;
+
+/**
+ * The whole heap is a single range of address space reserved at start, so
+ * that references can be stored as offsets into it. Its pages are only
+ * backed by memory once touched, and read as zero until then. Regions and
+ * large objects are carved out of the range as spans of pages, and handed
+ * back with MADV_DONTNEED, which returns their memory to the system and has
+ * them read as zero again for the next user.
+ */
+typedef struct {
+    char *start;
+    size_t size;
+} span_t;
+
+/* free spans of the range, sorted by address */
+static span_t *spans;
+static size_t span_count, span_capacity;
+
+static size_t page_size;
+
+static size_t page_align(size_t size)
 {
-    /* max contain 5000 object */
-    object_heap.objects = malloc(sizeof(object_t *) * 5000);
-    object_heap.length = 0;
+    return (size + page_size - 1) & ~(page_size - 1);
 }
 
-/* create java object */
-object_t *create_object(class_file_t *clazz)
+static void insert_span(size_t index, char *start, size_t size)
 {
-    size_t size = clazz->fields_count * sizeof(variable_t);
-    object_t *new_obj = malloc(sizeof(object_t));
-    new_obj->field_count = clazz->fields_count;
-    /* prevent undefined behavior */
-    if (size == 0) {
-        new_obj->ptr = NULL;
+    if (span_count == span_capacity) {
+        span_capacity = span_capacity ? span_capacity * 2 : 64;
+        spans = realloc(spans, sizeof(span_t) * span_capacity);
+        assert(spans && "Failed to grow span list");
+    }
+    memmove(&spans[index + 1], &spans[index],
+            sizeof(span_t) * (span_count - index));
+    spans[index] = (span_t){start, size};
+    span_count++;
+}
+
+static void remove_span(size_t index)
+{
+    memmove(&spans[index], &spans[index + 1],
+            sizeof(span_t) * (span_count - index - 1));
+    span_count--;
+}
+
+/* first fit of size bytes at an address aligned to align */
+static void *alloc_span(size_t size, size_t align)
+{
+    for (size_t i = 0; i < span_count; i++) {
+        span_t *span = &spans[i];
+        char *start = (char *) (((uintptr_t) span->start + align - 1) &
+                                ~(uintptr_t) (align - 1));
+        size_t pad = start - span->start;
+        if (span->size < pad + size)
+            continue;
+
+        char *end = span->start + span->size;
+        if (pad) {
+            span->size = pad;
+            if (end > start + size)
+                insert_span(i + 1, start + size, end - start - size);
+        } else if (end > start + size) {
+            span->start += size;
+            span->size -= size;
+        } else {
+            remove_span(i);
+        }
+        return start;
+    }
+    fprintf(stderr, "Exception in thread \"main\" "
+                    "java.lang.OutOfMemoryError: Java heap space\n");
+    exit(1);
+}
+
+/* give the pages of a span back, merging it with its free neighbors */
+static void free_span(void *address, size_t size)
+{
+    char *start = address;
+    madvise(start, size, MADV_DONTNEED);
+
+    size_t i = 0;
+    while (i < span_count && spans[i].start < start)
+        i++;
+    if (i > 0 && spans[i - 1].start + spans[i - 1].size == start) {
+        spans[i - 1].size += size;
+        if (i < span_count && start + size == spans[i].start) {
+            spans[i - 1].size += spans[i].size;
+            remove_span(i);
+        }
+    } else if (i < span_count && start + size == spans[i].start) {
+        spans[i].start = start;
+        spans[i].size += size;
     } else {
-        new_obj->ptr = malloc(size);
-        memset(&new_obj->ptr->value, 0, size);
-        for (int i = 0; i < clazz->fields_count; ++i) {
-            new_obj->ptr[i].type = VAR_NONE;
+        insert_span(i, start, size);
+    }
+}
+
+/* give the memory of a large object back to the system */
+void free_large_object(heap_header_t *header)
+{
+    free_span(header, page_align(header->size));
+}
+
+void init_object_heap(size_t max_bytes, size_t nursery_size)
+{
+    page_size = sysconf(_SC_PAGESIZE);
+    /* room for what is allocated between collections beyond the limit, and
+     * for fragmentation */
+    object_heap.reserved = HEAP_RESERVE(max_bytes);
+    object_heap.base = mmap(NULL, object_heap.reserved, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(object_heap.base != MAP_FAILED && "Failed to reserve heap");
+    insert_span(0, object_heap.base, object_heap.reserved);
+
+    /* the nursery takes at most half of the heap */
+    if (nursery_size > max_bytes / 2)
+        nursery_size = max_bytes / 2;
+    nursery_size = page_align(nursery_size);
+    /* first in the range, so that no reference is stored as 0 */
+    object_heap.nursery = alloc_span(nursery_size, page_size);
+    object_heap.nursery_size = nursery_size;
+    object_heap.young_top = object_heap.nursery;
+    object_heap.young_end = object_heap.nursery + nursery_size;
+
+    object_heap.capacity = OBJECT_HEAP_CAPACITY;
+    object_heap.objects =
+        malloc(sizeof(heap_header_t *) * object_heap.capacity);
+    assert(object_heap.objects && "Failed to allocate object heap");
+    object_heap.length = 0;
+    object_heap.regions = NULL;
+    object_heap.top = object_heap.end = NULL;
+    object_heap.bytes = 0;
+    object_heap.allocated_bytes = 0;
+    object_heap.allocated_objects = 0;
+    memset(object_heap.allocated_kinds, 0,
+           sizeof(object_heap.allocated_kinds));
+    object_heap.allocated_at_collection = 0;
+    gettimeofday(&object_heap.last_collection, NULL);
+    object_heap.max_bytes = max_bytes - nursery_size;
+    object_heap.threshold = GC_INITIAL_THRESHOLD < object_heap.max_bytes
+                                ? GC_INITIAL_THRESHOLD
+                                : object_heap.max_bytes;
+}
+
+/* stop allocating from the current free space, which stays a dead block
+ * for the next sweep to merge with its neighbors */
+void retire_region()
+{
+    object_heap.top = object_heap.end = NULL;
+}
+
+static void request_collection()
+{
+    if (object_heap.bytes > object_heap.threshold)
+        gc_requested = true;
+}
+
+void pointer_list_push(pointer_list_t *list, void *item)
+{
+    if (list->length == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = realloc(list->items, sizeof(void *) * list->capacity);
+        assert(list->items && "Failed to grow remembered set");
+    }
+    list->items[list->length++] = item;
+}
+
+/* slow path of write_barrier(), slot of the old object holder now refers to
+ * a young object */
+void remember_slot(void *holder, void *slot)
+{
+    heap_header_t *header = block_of(holder);
+    /* frame objects are scanned as roots by every collection */
+    if (header->flags & HEAP_FRAME)
+        return;
+    if (header->flags & HEAP_LARGE) {
+        if (!(header->flags & HEAP_REMEMBERED)) {
+            header->flags |= HEAP_REMEMBERED;
+            pointer_list_push(&object_heap.remembered, header);
         }
+        return;
+    }
+
+    region_t *region = REGION_OF(slot);
+    u1 *card = &region->cards[((char *) slot - (char *) region) / CARD_SIZE];
+    if (!*card) {
+        *card = 1;
+        pointer_list_push(&object_heap.dirty_cards, card);
+    }
+}
+
+/* allocate from the first hole total bytes fit in, if any */
+static bool take_hole(size_t total)
+{
+    pointer_list_t *holes = &object_heap.holes;
+    for (size_t i = object_heap.next_hole; i < holes->length; i++) {
+        heap_header_t *hole = holes->items[i];
+        if (hole->size < total)
+            continue;
+        /* holes too small for this object are left for smaller ones */
+        holes->items[i] = holes->items[object_heap.next_hole];
+        holes->items[object_heap.next_hole++] = hole;
+        object_heap.top = (char *) hole;
+        object_heap.end = (char *) hole + hole->size;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Allocate a zeroed block of total bytes in the old space, used for objects
+ * promoted out of the nursery, for large objects, and for objects allocated
+ * while the nursery is full.
+ */
+void *alloc_old(size_t total)
+{
+    if (total >= LARGE_OBJECT_SIZE) {
+        heap_header_t *header = alloc_span(page_align(total), page_size);
+        header->flags = HEAP_LARGE;
+        if (object_heap.length == object_heap.capacity) {
+            object_heap.capacity *= 2;
+            object_heap.objects =
+                realloc(object_heap.objects,
+                        sizeof(heap_header_t *) * object_heap.capacity);
+            assert(object_heap.objects && "Failed to grow object heap");
+        }
+        object_heap.objects[object_heap.length++] = header;
+        object_heap.bytes += total;
+        request_collection();
+        return header;
+    }
+
+    /* what is left of the current free space stays a dead block */
+    if ((size_t) (object_heap.end - object_heap.top) < total &&
+        !take_hole(total)) {
+        /* unused pages are zero, as objects are expected to be */
+        region_t *region = alloc_span(REGION_SIZE, REGION_SIZE);
+        region->end = (char *) region + REGION_SIZE;
+        region->next = object_heap.regions;
+        object_heap.regions = region;
+        object_heap.top = REGION_OBJECTS(region);
+        object_heap.end = region->end;
+    }
+
+    /* the object covers the first byte of the cards starting inside it */
+    region_t *region = REGION_OF(object_heap.top);
+    u4 offset = object_heap.top - (char *) region;
+    for (u4 card = (offset + CARD_SIZE - 1) / CARD_SIZE;
+         card * CARD_SIZE < offset + total; card++)
+        region->starts[card] = offset;
+
+    heap_header_t *header = (heap_header_t *) object_heap.top;
+    object_heap.top += total;
+    /* the rest of the free space is a dead block, so the region can be
+     * walked, and the header of the one allocated from is cleared */
+    if (object_heap.top < object_heap.end) {
+        heap_header_t *rest = (heap_header_t *) object_heap.top;
+        rest->size = object_heap.end - object_heap.top;
+        rest->kind = OBJECT_DEAD;
     }
+    memset(header, 0, sizeof(heap_header_t));
+    object_heap.bytes += total;
+    request_collection();
+    return header;
+}
+
+/* allocation slow path, when the object does not fit in the nursery */
+static heap_header_t *alloc_slow(size_t total)
+{
+    /* the nursery is full, collect it at the next safepoint and put the
+     * objects allocated until then in the old space */
+    if (total < LARGE_OBJECT_SIZE)
+        gc_requested = true;
+    return alloc_old(total);
+}
+
+/**
+ * Allocate a zeroed block of the given kind with size bytes after its header,
+ * and return the reference to it. Small objects take a pointer increment in
+ * the nursery, large ones go to the old space right away. Allocation never
+ * collects by itself, since the caller may hold references the collector
+ * cannot see, it only requests a collection at the next safepoint.
+ */
+static inline void *heap_alloc(size_t size, u1 kind, u4 length)
+{
+    size_t total = (sizeof(heap_header_t) + size + OBJECT_ALIGNMENT - 1) &
+                   ~(size_t) (OBJECT_ALIGNMENT - 1);
+    heap_header_t *header = (heap_header_t *) object_heap.young_top;
+    if (total < LARGE_OBJECT_SIZE &&
+        (size_t) (object_heap.young_end - object_heap.young_top) >= total)
+        object_heap.young_top += total;
+    else
+        header = alloc_slow(total);
+
+    header->size = total;
+    header->length = length;
+    header->kind = kind;
+    object_heap.allocated_bytes += total;
+    object_heap.allocated_objects++;
+    object_heap.allocated_kinds[kind]++;
+    return header + 1;
+}
+
+/* same as heap_alloc(), but in the old space, for long lived objects */
+static void *heap_alloc_old(size_t size, u1 kind, u4 length)
+{
+    size_t total = (sizeof(heap_header_t) + size + OBJECT_ALIGNMENT - 1) &
+                   ~(size_t) (OBJECT_ALIGNMENT - 1);
+    heap_header_t *header = alloc_old(total);
+    header->size = total;
+    header->length = length;
+    header->kind = kind;
+    object_heap.allocated_bytes += total;
+    object_heap.allocated_objects++;
+    object_heap.allocated_kinds[kind]++;
+    return header + 1;
+}
+
+/* create java object */
+/* bytes of the block of an instance of clazz, header included */
+size_t object_block_size(class_file_t *clazz)
+{
+    return sizeof(heap_header_t) + sizeof(object_t) +
+           clazz->fields_count * sizeof(variable_t);
+}
+
+static object_t *init_object(object_t *new_obj, class_file_t *clazz)
+{
+    new_obj->field_count = clazz->fields_count;
+    /* prevent undefined behavior, fields are already zero, so VAR_NONE */
+    new_obj->ptr = clazz->fields_count ? (variable_t *) (new_obj + 1) : NULL;
     new_obj->type = clazz;
-    object_heap.objects[object_heap.length++] = new_obj;
     return new_obj;
 }
 
-/* create array object, place it address in object heap */
-void *create_array(class_file_t *clazz, int count)
+object_t *create_object(class_file_t *clazz)
 {
-    void *arr = malloc(count * sizeof(int));
-    object_t *arr_obj = malloc(sizeof(object_t));
-    arr_obj->ptr = malloc(sizeof(variable_t));
-    arr_obj->ptr->type = VAR_ARRAY_PTR;
-    arr_obj->ptr->value.ptr_value = arr;
-    /* this type attribute is useless */
-    arr_obj->type = clazz;
-    object_heap.objects[object_heap.length++] = arr_obj;
-    arr_obj->field_count = 1;
+    object_t *new_obj =
+        heap_alloc(object_block_size(clazz) - sizeof(heap_header_t),
+                   OBJECT_INSTANCE, 0);
+    return init_object(new_obj, clazz);
+}
+
+/**
+ * Make block, of object_block_size() bytes in a frame, a new instance of
+ * clazz. The collector does not manage it, but follows its fields as roots
+ * as long as the frame is active.
+ */
+object_t *init_frame_object(void *block, class_file_t *clazz)
+{
+    size_t size = object_block_size(clazz);
+    memset(block, 0, size);
+    heap_header_t *header = block;
+    header->size = size;
+    header->kind = OBJECT_INSTANCE;
+    header->flags = HEAP_FRAME;
+    return init_object((object_t *) (header + 1), clazz);
+}
 
+/* create array of count elements of the given array_type_t in object heap,
+ * its elements are zero */
+void *create_array(class_file_t *clazz, u1 type, int count)
+{
+    (void) clazz;
+    void *arr = heap_alloc(count * array_element_size(type), OBJECT_ARRAY,
+                           count);
+    header_of(arr)->type = type;
     return arr;
 }
 
+/* create array of count null references in object heap */
+ref_t *create_reference_array(int count)
+{
+    return heap_alloc(count * sizeof(ref_t), OBJECT_REF_ARRAY, count);
+}
+
+/* array_type_t of a primitive field descriptor, 0 for references */
+static u1 array_type_of(char descriptor)
+{
+    switch (descriptor) {
+    case 'Z':
+        return T_BOOLEN;
+    case 'C':
+        return T_CHAR;
+    case 'F':
+        return T_FLOAT;
+    case 'D':
+        return T_DOUBLE;
+    case 'B':
+        return T_BYTE;
+    case 'S':
+        return T_SHORT;
+    case 'I':
+        return T_INT;
+    case 'J':
+        return T_LONG;
+    default:
+        return 0;
+    }
+}
+
 /**
- * create two dimension array, place it address in object heap
- * note that:
- *      field 0 store array address,
- *      field 1 store first dimension size
- *      field 2 store second dimension size
+ * Create a multi-dimensional array of the given array type descriptor, with
+ * counts[i] elements in dimension i, as a single block. The arrays of every
+ * dimension are laid out one dimension after the other, the leaf arrays
+ * holding the elements last, each with a header of its own. The arrays of
+ * the last dimension are arrays of null references when the descriptor has
+ * more dimensions than counts.
  */
-void **create_two_dimension_array(class_file_t *clazz, int count1, int count2)
+void *create_multi_array(class_file_t *clazz,
+                         const char *descriptor,
+                         u1 dimensions,
+                         const int32_t *counts)
 {
-    /* only support integer array */
-    int **arr = malloc(count1 * sizeof(int *));
-    for (int i = 0; i < count1; ++i) {
-        arr[i] = malloc(count2 * sizeof(int));
+    (void) clazz;
+    u1 leaf_type = array_type_of(descriptor[dimensions]);
+    size_t leaf_size = leaf_type ? array_element_size(leaf_type)
+                                 : sizeof(ref_t);
+
+    size_t size = 0, arrays = 1;
+    for (u1 i = 0; i < dimensions; i++) {
+        size_t elem_size = i + 1 < dimensions ? sizeof(ref_t) : leaf_size;
+        size += arrays * array_block_size(counts[i], elem_size);
+        arrays *= counts[i];
     }
-    object_t *arr_obj = malloc(sizeof(object_t));
-    arr_obj->ptr = malloc(sizeof(variable_t) * 3);
-    arr_obj->ptr[0].type = VAR_MULTARRAY_PTR;
-    arr_obj->ptr[0].value.ptr_value = arr;
-    arr_obj->ptr[1].type = VAR_INT;
-    arr_obj->ptr[1].value.int_value = count1;
-    arr_obj->ptr[2].type = VAR_INT;
-    arr_obj->ptr[2].value.int_value = count2;
-    /* this type attribute is useless */
-    arr_obj->type = clazz;
-    object_heap.objects[object_heap.length++] = arr_obj;
-    arr_obj->field_count = 3;
+    heap_header_t *block = header_of(heap_alloc(size, OBJECT_MULTIARRAY, 0));
 
-    return (void **) arr;
+    /* arrays of the dimension being laid out, and where the next goes */
+    char *level = (char *) (block + 1);
+    char *next = level;
+    arrays = 1;
+    for (u1 i = 0; i < dimensions; i++) {
+        bool leaf = i + 1 == dimensions;
+        size_t elem_size = leaf ? leaf_size : sizeof(ref_t);
+        size_t step = array_block_size(counts[i], elem_size);
+        size_t child_step =
+            leaf ? 0
+                 : array_block_size(counts[i + 1], i + 2 < dimensions
+                                                       ? sizeof(ref_t)
+                                                       : leaf_size);
+        char *children = level + arrays * step;
+        for (size_t j = 0; j < arrays; j++, next += step) {
+            heap_header_t *header = (heap_header_t *) next;
+            header->size = next - (char *) block;
+            header->length = counts[i];
+            header->flags = HEAP_INTERIOR;
+            if (leaf && leaf_type) {
+                header->kind = OBJECT_ARRAY;
+                header->type = leaf_type;
+                continue;
+            }
+            header->kind = OBJECT_REF_ARRAY;
+            if (leaf)
+                continue;
+            /* children are in the same block, no write barrier needed */
+            ref_t *elements = (ref_t *) (header + 1);
+            for (int32_t k = 0; k < counts[i]; k++) {
+                elements[k] = encode_ref((heap_header_t *) children + 1);
+                children += child_step;
+            }
+        }
+        level = next;
+        arrays *= counts[i];
+    }
+    return block + 2;
 }
 
 /**
  *  create string object and put it in object heap
  *  clazz must be java/lang/String
  */
-char *create_string(class_file_t *clazz, char *src)
+string_t *create_string(class_file_t *clazz, char *src)
+{
+    return create_string_from_utf8(clazz, src, strlen(src));
+}
+
+/**
+ * create string object from len bytes of (Modified) UTF-8, which need not be
+ * terminated. The string is stored as Latin-1 unless some character does not
+ * fit, runs of ASCII are copied without being decoded.
+ */
+static string_t *new_string(size_t len, u1 coder, bool old)
 {
-    char *dest = malloc((strlen(src) + 1) * sizeof(char));
-    strcpy(dest, src);
-    object_t *str_obj = malloc(sizeof(object_t));
-    str_obj->ptr = malloc(sizeof(variable_t));
-    str_obj->ptr->type = VAR_STR_PTR;
-    str_obj->ptr->value.ptr_value = dest;
-    str_obj->type = clazz;
-    object_heap.objects[object_heap.length++] = str_obj;
-    str_obj->field_count = 1;
+    /* terminated for both coders */
+    size_t size = sizeof(string_t) + string_size(len, coder) + 2;
+    string_t *str = old ? heap_alloc_old(size, OBJECT_STRING, 0)
+                        : heap_alloc(size, OBJECT_STRING, 0);
+    str->length = len;
+    str->coder = coder;
+    return str;
+}
+
+static string_t *decode_string(const char *src, size_t len, bool old)
+{
+    if (is_ascii(src, len)) {
+        string_t *str = new_string(len, STRING_LATIN1, old);
+        memcpy(str->value, src, len);
+        return str;
+    }
 
-    return dest;
+    u1 coder;
+    size_t length = utf8_decoded_length(src, len, &coder);
+    string_t *str = new_string(length, coder, old);
+    utf8_decode(src, len, str->value, coder);
+    return str;
+}
+
+string_t *create_string_from_utf8(class_file_t *clazz,
+                                  const char *src,
+                                  size_t len)
+{
+    (void) clazz;
+    return decode_string(src, len, false);
+}
+
+/**
+ * Resolve a CONSTANT_String to its interned string object. The constant is
+ * decoded on its first resolution only, later ones return the cached object.
+ * Constants live as long as their class, so they are created in the old
+ * space, which spares minor collections the intern table and the caches.
+ */
+string_t *resolve_string_constant(class_file_t *clazz,
+                                  CONSTANT_String_info *info)
+{
+    if (!info->resolved) {
+        const_pool_info *utf8 =
+            get_constant(&clazz->constant_pool, info->string_index);
+        assert(utf8->tag == CONSTANT_Utf8 && "Expected a UTF8");
+        char *src = (char *) utf8->info;
+        size_t len = strlen(src);
+        /* ASCII text is its own Latin-1 payload, so look it up undecoded */
+        string_t *str = is_ascii(src, len)
+                            ? find_interned_string(src, len, STRING_LATIN1)
+                            : NULL;
+        if (!str)
+            str = intern_string(decode_string(src, len, true));
+        info->resolved = str;
+    }
+    return info->resolved;
+}
+
+/**
+ * allocate a string object of len characters in a single block, the caller
+ * fills in the payload in the given coder
+ */
+string_t *alloc_string(class_file_t *clazz, size_t len, u1 coder)
+{
+    (void) clazz;
+    return new_string(len, coder, false);
 }
 
 size_t get_field_size(class_file_t *clazz)
@@ -140,25 +610,18 @@ variable_t *find_field_addr(object_t *obj, char *name)
     return NULL;
 }
 
+/* free a region that no longer holds live objects */
+void free_region(region_t *region)
+{
+    free_span(region, REGION_SIZE);
+}
+
 void free_object_heap()
 {
-    for (int i = 0; i < object_heap.length; ++i) {
-        if (object_heap.objects[i]->ptr) {
-            if (object_heap.objects[i]->ptr->type == VAR_STR_PTR) {
-                free(object_heap.objects[i]->ptr->value.ptr_value);
-            } else if (object_heap.objects[i]->ptr->type == VAR_ARRAY_PTR) {
-                free(object_heap.objects[i]->ptr->value.ptr_value);
-            } else if (object_heap.objects[i]->ptr->type == VAR_MULTARRAY_PTR) {
-                int count = object_heap.objects[i]->ptr[1].value.int_value;
-                int **addr = object_heap.objects[i]->ptr[0].value.ptr_value;
-                for (int j = 0; j < count; ++j) {
-                    free(addr[j]);
-                }
-                free(addr);
-            }
-        }
-        free(object_heap.objects[i]->ptr);
-        free(object_heap.objects[i]);
-    }
+    free(object_heap.dirty_cards.items);
+    free(object_heap.remembered.items);
+    free(object_heap.holes.items);
     free(object_heap.objects);
-}
\ No newline at end of file
+    free(spans);
+    munmap(object_heap.base, object_heap.reserved);
+}
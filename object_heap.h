@@ -1,8 +1,63 @@
 #pragma once
 
+#include <stdint.h>
+#include <sys/time.h>
+
 #include "java_file.h"
+#include "java_string.h"
+
+/* initial number of large objects the heap can track, grown as needed */
+#define OBJECT_HEAP_CAPACITY 256
+/* size of a region objects are bump allocated from */
+#define REGION_SIZE (256 * 1024)
+/* objects at least this large take pages of their own */
+#define LARGE_OBJECT_SIZE (REGION_SIZE / 4)
+/* address space reserved for a heap limited to max bytes */
+#define HEAP_RESERVE(max) (2 * (max))
+/* alignment of every object */
+#define OBJECT_ALIGNMENT 16
+/* default size of the nursery young objects are allocated from, -Xmn */
+#define NURSERY_SIZE ((size_t) 4 * 1024 * 1024)
+/* bytes of a region covered by one card of the card table */
+#define CARD_SIZE 512
+#define REGION_CARDS (REGION_SIZE / CARD_SIZE)
+/* free space of a region allocated from again, smaller pieces wait for
+ * their neighbors to die */
+#define MIN_HOLE_SIZE CARD_SIZE
+
+/* what follows a heap header */
+typedef enum {
+    OBJECT_INSTANCE, /* object_t and its fields */
+    OBJECT_STRING,   /* string_t */
+    OBJECT_ARRAY,    /* primitive elements of the type in the header */
+    OBJECT_REF_ARRAY, /* references */
+    OBJECT_MULTIARRAY, /* the arrays of a multi-dimensional array */
+    OBJECT_DEAD,      /* free space in a region in use */
+    OBJECT_FORWARDED  /* young object copied to the old space */
+} object_kind_t;
 
+/* heap header flags */
+#define HEAP_LARGE 1      /* allocated on its own rather than in a region */
+#define HEAP_REMEMBERED 2 /* large object that may refer to young objects */
+#define HEAP_INTERIOR 4   /* array inside an OBJECT_MULTIARRAY block */
+#define HEAP_FRAME 8      /* object allocated in a frame, see escape.h */
 
+/**
+ * Header in front of everything allocated in the object heap. References
+ * point just past it, so the header of any reference is found by
+ * header_of() whatever the reference points to.
+ */
+typedef struct {
+    /* bytes of the whole block, header included, or once forwarded the
+     * address of the copy, or for a HEAP_INTERIOR array the offset of its
+     * header from the header of the block */
+    size_t size;
+    u4 length; /* number of elements of an array */
+    u1 kind;   /* object_kind_t */
+    bool marked;
+    u1 flags;
+    u1 type; /* array_type_t of the elements of an OBJECT_ARRAY */
+} heap_header_t;
 
 typedef struct {
     variable_t *ptr;
@@ -10,19 +65,214 @@ typedef struct {
     size_t field_count;
 } object_t;
 
+/**
+ * A chunk of old space, its header followed by blocks laid out back to back
+ * up to end: objects, and OBJECT_DEAD blocks of free space, which is zero
+ * past the header of its block. Objects are carved from the start of free
+ * space by bumping a pointer. Regions are aligned to their size, so the
+ * region, and the card, of any address in it is found by masking the
+ * address.
+ *
+ * A card is dirty when a reference to a young object may have been stored
+ * in the REGION_CARDS bytes it covers. starts[] gives the offset of the
+ * object covering the first byte of every card, where the collector starts
+ * walking objects to scan a dirty card.
+ */
+typedef struct region {
+    char *end;
+    struct region *next;
+    u1 cards[REGION_CARDS];
+    u4 starts[REGION_CARDS];
+} region_t;
+
+#define REGION_OF(addr)                                                      \
+    ((region_t *) ((uintptr_t) (addr) & ~(uintptr_t) (REGION_SIZE - 1)))
+
+/* first object of a region, right after the aligned region header */
+#define REGION_OBJECTS(region)                                               \
+    ((char *) (region) + ((sizeof(region_t) + OBJECT_ALIGNMENT - 1) &       \
+                          ~(size_t) (OBJECT_ALIGNMENT - 1)))
 
+/* growable array of pointers, for the remembered sets */
 typedef struct {
-    u2 length;
-    object_t **objects;
+    void **items;
+    size_t length;
+    size_t capacity;
+} pointer_list_t;
+
+/**
+ * The heap is split in two generations. New objects are bump allocated in
+ * the nursery, and the live ones are copied to the old space by a minor
+ * collection. The old space is made of regions and large objects, and is
+ * collected by mark-sweep.
+ */
+typedef struct {
+    char *base; /* start of the address range of the heap */
+    size_t reserved;
+    char *nursery; /* young objects, between nursery and young_top */
+    char *young_top;
+    char *young_end;
+    size_t nursery_size;
+    region_t *regions;
+    char *top; /* bump pointer into the free space allocated from */
+    char *end;
+    /* dead blocks of at least MIN_HOLE_SIZE left by the last major
+     * collection, those before next_hole taken already */
+    pointer_list_t holes;
+    size_t next_hole;
+    size_t length; /* large objects, allocated on their own */
+    size_t capacity;
+    heap_header_t **objects;
+    /* old-to-young references recorded by the write barrier */
+    pointer_list_t dirty_cards;   /* dirty card bytes of regions */
+    pointer_list_t remembered;    /* headers of HEAP_REMEMBERED objects */
+    bool young_statics;           /* some static field refers to the young */
+    bool young_interned;          /* some interned string is young */
+    /* bytes of the old objects live at the last major collection, and of
+     * those allocated since */
+    size_t bytes;
+    size_t threshold; /* old bytes that trigger the next major collection */
+    size_t max_bytes; /* the -Xmx limit, less the nursery */
+    /* allocation counters since start, for the allocation rate */
+    size_t allocated_bytes;
+    size_t allocated_objects;
+    size_t allocated_kinds[OBJECT_DEAD]; /* objects of each object_kind_t */
+    size_t allocated_at_collection; /* allocated_bytes at last collection */
+    struct timeval last_collection;
 } object_heap_t;
 
-// move to jvm.c
-object_heap_t object_heap;
+extern object_heap_t object_heap;
+
+#ifdef COMPRESSED_REFS
+/**
+ * Arrays store references as 32-bit offsets into the heap range, in units
+ * of the object alignment, which covers a range of 64 GiB. Null is 0, the
+ * nursery being first in the range no object starts at its base.
+ */
+typedef u4 ref_t;
+#define REF_SHIFT 4
+/* largest -Xmx, whose reserved range must fit in what offsets reach */
+#define COMPRESSED_HEAP_LIMIT ((size_t) 32 << 30)
+
+static inline void *decode_ref(ref_t ref)
+{
+    return ref ? object_heap.base + ((size_t) ref << REF_SHIFT) : NULL;
+}
+
+static inline ref_t encode_ref(void *ptr)
+{
+    return ptr ? (ref_t) (((char *) ptr - object_heap.base) >> REF_SHIFT)
+               : 0;
+}
+#else
+typedef void *ref_t;
+
+static inline void *decode_ref(ref_t ref)
+{
+    return ref;
+}
+
+static inline ref_t encode_ref(void *ptr)
+{
+    return ptr;
+}
+#endif
+
+static inline heap_header_t *header_of(void *ref)
+{
+    return (heap_header_t *) ref - 1;
+}
+
+/* bytes of an element of a primitive array */
+static inline size_t array_element_size(u1 type)
+{
+    switch (type) {
+    case T_BOOLEN:
+    case T_BYTE:
+        return 1;
+    case T_CHAR:
+    case T_SHORT:
+        return 2;
+    case T_FLOAT:
+    case T_INT:
+        return 4;
+    default:
+        /* T_DOUBLE and T_LONG */
+        return 8;
+    }
+}
+
+/**
+ * Header of the block holding ref. It is the header of ref itself, except
+ * for the arrays inside a multi-dimensional array, which live and die with
+ * the block they were created in.
+ */
+static inline heap_header_t *block_of(void *ref)
+{
+    heap_header_t *header = header_of(ref);
+    if (header->flags & HEAP_INTERIOR)
+        return (heap_header_t *) ((char *) header - header->size);
+    return header;
+}
+
+/* bytes taken by an array of length elements of elem_size bytes, header
+ * included */
+static inline size_t array_block_size(u4 length, size_t elem_size)
+{
+    return (sizeof(heap_header_t) + length * elem_size + OBJECT_ALIGNMENT -
+            1) &
+           ~(size_t) (OBJECT_ALIGNMENT - 1);
+}
+
+/* whether ref points into the nursery, false for NULL */
+static inline bool is_young(void *ref)
+{
+    return (uintptr_t) ref - (uintptr_t) object_heap.nursery <
+           object_heap.nursery_size;
+}
+
+void pointer_list_push(pointer_list_t *list, void *item);
+void remember_slot(void *holder, void *slot);
+
+/**
+ * Write barrier, to be called after value was stored in slot, a field or an
+ * element of the object holder. Old-to-young references are the only ones
+ * a minor collection cannot find from its roots, so they are remembered by
+ * dirtying the card of the slot.
+ */
+static inline void write_barrier(void *holder, void *slot, void *value)
+{
+    if (is_young(value) && !is_young(holder))
+        remember_slot(holder, slot);
+}
+
+/* write barrier of static fields, which are all scanned when one is dirty */
+static inline void static_write_barrier(void *value)
+{
+    if (is_young(value))
+        object_heap.young_statics = true;
+}
 
-void init_object_heap();
+void init_object_heap(size_t max_bytes, size_t nursery_size);
+void retire_region();
+void *alloc_old(size_t total);
+void free_large_object(heap_header_t *header);
+void free_region(region_t *region);
 void free_object_heap();
+size_t object_block_size(class_file_t *clazz);
 object_t *create_object(class_file_t *clazz);
+object_t *init_frame_object(void *block, class_file_t *clazz);
 variable_t *find_field_addr(object_t *obj, char *name);
-void *create_array(class_file_t *clazz, int count);
-void **create_two_dimension_array(class_file_t *clazz, int count1, int count2);
-char *create_string(class_file_t *clazz, char *src);
+void *create_array(class_file_t *clazz, u1 type, int count);
+ref_t *create_reference_array(int count);
+void *create_multi_array(class_file_t *clazz,
+                         const char *descriptor,
+                         u1 dimensions,
+                         const int32_t *counts);
+string_t *create_string(class_file_t *clazz, char *src);
+string_t *create_string_from_utf8(class_file_t *clazz,
+                                  const char *src,
+                                  size_t len);
+string_t *alloc_string(class_file_t *clazz, size_t len, u1 coder);
+string_t *resolve_string_constant(class_file_t *clazz,
+                                  CONSTANT_String_info *info);
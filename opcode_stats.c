@@ -0,0 +1,269 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcode_stats.h"
+
+u8 opcode_counts[256];
+u8 opcode_pair_counts[256][256];
+
+/**
+ * Execution counts of opcodes, and of pairs of opcodes run one after the
+ * other, to pick superinstructions and instructions worth quickening, and
+ * to see which parts of the interpreter a program exercises. Counting costs
+ * a few memory updates per instruction, so interpret() only counts when
+ * built with make OPCODE_STATS=1, and the counts are reported on standard
+ * error when main returns.
+ */
+
+/* initial capacity of the pair table of a method, a power of 2 */
+#define PAIR_TABLE_CAPACITY 64
+
+static const char *opcode_names[] = {
+    /* 0x00 */ "nop", "aconst_null", "iconst_m1", "iconst_0", "iconst_1",
+                "iconst_2", "iconst_3", "iconst_4", "iconst_5", "lconst_0",
+                "lconst_1", "fconst_0", "fconst_1", "fconst_2", "dconst_0",
+                "dconst_1",
+    /* 0x10 */ "bipush", "sipush", "ldc", "ldc_w", "ldc2_w", "iload", "lload",
+                "fload", "dload", "aload", "iload_0", "iload_1", "iload_2",
+                "iload_3", "lload_0", "lload_1",
+    /* 0x20 */ "lload_2", "lload_3", "fload_0", "fload_1", "fload_2", "fload_3",
+                "dload_0", "dload_1", "dload_2", "dload_3", "aload_0",
+                "aload_1", "aload_2", "aload_3", "iaload", "laload",
+    /* 0x30 */ "faload", "daload", "aaload", "baload", "caload", "saload",
+                "istore", "lstore", "fstore", "dstore", "astore", "istore_0",
+                "istore_1", "istore_2", "istore_3", "lstore_0",
+    /* 0x40 */ "lstore_1", "lstore_2", "lstore_3", "fstore_0", "fstore_1",
+                "fstore_2", "fstore_3", "dstore_0", "dstore_1", "dstore_2",
+                "dstore_3", "astore_0", "astore_1", "astore_2", "astore_3",
+                "iastore",
+    /* 0x50 */ "lastore", "fastore", "dastore", "aastore", "bastore", "castore",
+                "sastore", "pop", "pop2", "dup", "dup_x1", "dup_x2", "dup2",
+                "dup2_x1", "dup2_x2", "swap",
+    /* 0x60 */ "iadd", "ladd", "fadd", "dadd", "isub", "lsub", "fsub", "dsub",
+                "imul", "lmul", "fmul", "dmul", "idiv", "ldiv", "fdiv", "ddiv",
+    /* 0x70 */ "irem", "lrem", "frem", "drem", "ineg", "lneg", "fneg", "dneg",
+                "ishl", "lshl", "ishr", "lshr", "iushr", "lushr", "iand",
+                "land",
+    /* 0x80 */ "ior", "lor", "ixor", "lxor", "iinc", "i2l", "i2f", "i2d", "l2i",
+                "l2f", "l2d", "f2i", "f2l", "f2d", "d2i", "d2l",
+    /* 0x90 */ "d2f", "i2b", "i2c", "i2s", "lcmp", "fcmpl", "fcmpg", "dcmpl",
+                "dcmpg", "ifeq", "ifne", "iflt", "ifge", "ifgt", "ifle",
+                "if_icmpeq",
+    /* 0xa0 */ "if_icmpne", "if_icmplt", "if_icmpge", "if_icmpgt", "if_icmple",
+                "if_acmpeq", "if_acmpne", "goto", "jsr", "ret", "tableswitch",
+                "lookupswitch", "ireturn", "lreturn", "freturn", "dreturn",
+    /* 0xb0 */ "areturn", "return", "getstatic", "putstatic", "getfield",
+                "putfield", "invokevirtual", "invokespecial", "invokestatic",
+                "invokeinterface", "invokedynamic", "new", "newarray",
+                "anewarray", "arraylength", "athrow",
+    /* 0xc0 */ "checkcast", "instanceof", "monitorenter", "monitorexit", "wide",
+                "multianewarray", "ifnull", "ifnonnull", "goto_w", "jsr_w",
+};
+
+/* the methods run so far */
+static struct {
+    opcode_stats_t **items;
+    size_t length;
+    size_t capacity;
+} methods;
+
+static const char *opcode_name(u1 opcode)
+{
+    if (opcode < sizeof(opcode_names) / sizeof(opcode_names[0]))
+        return opcode_names[opcode];
+    return "unknown";
+}
+
+opcode_stats_t *method_opcode_stats(method_t *method, class_file_t *clazz)
+{
+    if (method->opcode_stats)
+        return method->opcode_stats;
+
+    opcode_stats_t *stats = calloc(1, sizeof(opcode_stats_t));
+    assert(stats && "Failed to allocate opcode counts");
+    stats->method = method;
+    stats->clazz = clazz;
+    stats->pair_capacity = PAIR_TABLE_CAPACITY;
+    stats->pairs = calloc(stats->pair_capacity, sizeof(pair_count_t));
+    assert(stats->pairs && "Failed to allocate opcode counts");
+
+    if (methods.length == methods.capacity) {
+        methods.capacity = methods.capacity ? methods.capacity * 2 : 64;
+        methods.items = realloc(methods.items,
+                                methods.capacity * sizeof(opcode_stats_t *));
+        assert(methods.items && "Failed to allocate opcode counts");
+    }
+    methods.items[methods.length++] = stats;
+    method->opcode_stats = stats;
+    return stats;
+}
+
+static pair_count_t *find_pair_slot(pair_count_t *pairs, u4 capacity, u2 pair)
+{
+    u4 i = (pair * 0x9e3779b1u) >> 16 & (capacity - 1);
+    while (pairs[i].count && pairs[i].pair != pair)
+        i = (i + 1) & (capacity - 1);
+    return &pairs[i];
+}
+
+void count_method_pair(opcode_stats_t *stats, u2 pair)
+{
+    pair_count_t *slot = find_pair_slot(stats->pairs, stats->pair_capacity,
+                                        pair);
+    if (slot->count) {
+        slot->count++;
+        return;
+    }
+
+    if (2 * (stats->pair_count + 1) > stats->pair_capacity) {
+        u4 capacity = stats->pair_capacity * 2;
+        pair_count_t *pairs = calloc(capacity, sizeof(pair_count_t));
+        assert(pairs && "Failed to allocate opcode counts");
+        for (u4 i = 0; i < stats->pair_capacity; i++)
+            if (stats->pairs[i].count)
+                *find_pair_slot(pairs, capacity, stats->pairs[i].pair) =
+                    stats->pairs[i];
+        free(stats->pairs);
+        stats->pairs = pairs;
+        stats->pair_capacity = capacity;
+        slot = find_pair_slot(pairs, capacity, pair);
+    }
+    slot->pair = pair;
+    slot->count = 1;
+    stats->pair_count++;
+}
+
+static int compare_pair_counts(const void *a, const void *b)
+{
+    const pair_count_t *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return (int) x->pair - (int) y->pair;
+}
+
+static int compare_methods(const void *a, const void *b)
+{
+    const opcode_stats_t *x = *(opcode_stats_t **) a,
+                         *y = *(opcode_stats_t **) b;
+    if (x->instructions != y->instructions)
+        return x->instructions < y->instructions ? 1 : -1;
+    return 0;
+}
+
+/* sort the non-zero counts of the 256 opcodes, by count */
+static size_t sort_opcodes(const u8 *counts, pair_count_t *sorted)
+{
+    size_t length = 0;
+    for (int opcode = 0; opcode < 256; opcode++)
+        if (counts[opcode])
+            sorted[length++] =
+                (pair_count_t){.pair = opcode, .count = counts[opcode]};
+    qsort(sorted, length, sizeof(pair_count_t), compare_pair_counts);
+    return length;
+}
+
+static size_t at_most(size_t length, size_t limit)
+{
+    return length < limit ? length : limit;
+}
+
+static void print_opcodes(const char *indent,
+                          pair_count_t *sorted,
+                          size_t length,
+                          u8 total)
+{
+    for (size_t i = 0; i < length; i++)
+        fprintf(stderr, "%s%14llu %5.1f%%  %s\n", indent,
+                (unsigned long long) sorted[i].count,
+                100.0 * sorted[i].count / total, opcode_name(sorted[i].pair));
+}
+
+static void print_pairs(const char *indent,
+                        pair_count_t *sorted,
+                        size_t length,
+                        u8 total)
+{
+    for (size_t i = 0; i < length; i++)
+        fprintf(stderr, "%s%14llu %5.1f%%  %s %s\n", indent,
+                (unsigned long long) sorted[i].count,
+                100.0 * sorted[i].count / total,
+                opcode_name(sorted[i].pair >> 8),
+                opcode_name(sorted[i].pair & 0xff));
+}
+
+/* called once main returns, while classes are still loaded */
+void report_opcode_stats()
+{
+    pair_count_t opcodes[256];
+    u8 total = 0;
+    for (int opcode = 0; opcode < 256; opcode++)
+        total += opcode_counts[opcode];
+    if (!total)
+        return;
+
+    fprintf(stderr, "Opcodes, %llu instructions:\n",
+            (unsigned long long) total);
+    print_opcodes("", opcodes, sort_opcodes(opcode_counts, opcodes), total);
+
+    pair_count_t *pairs = malloc(256 * 256 * sizeof(pair_count_t));
+    assert(pairs && "Failed to allocate opcode counts");
+    size_t length = 0;
+    for (int first = 0; first < 256; first++)
+        for (int second = 0; second < 256; second++)
+            if (opcode_pair_counts[first][second])
+                pairs[length++] = (pair_count_t){
+                    .pair = first << 8 | second,
+                    .count = opcode_pair_counts[first][second]};
+    qsort(pairs, length, sizeof(pair_count_t), compare_pair_counts);
+    fprintf(stderr, "Opcode pairs, top %d of %zu:\n", OPCODE_STATS_TOP_PAIRS,
+            length);
+    print_pairs("", pairs, at_most(length, OPCODE_STATS_TOP_PAIRS), total);
+    free(pairs);
+
+    qsort(methods.items, methods.length, sizeof(opcode_stats_t *),
+          compare_methods);
+    fprintf(stderr, "Methods, top %d opcodes and pairs of each:\n",
+            OPCODE_STATS_METHOD_TOP);
+    for (size_t i = 0; i < methods.length; i++) {
+        opcode_stats_t *stats = methods.items[i];
+        if (!stats->instructions)
+            continue;
+        fprintf(stderr, "%14llu %5.1f%%  %s.%s%s\n",
+                (unsigned long long) stats->instructions,
+                100.0 * stats->instructions / total,
+                find_class_name_from_index(stats->clazz->this_class,
+                                           stats->clazz),
+                stats->method->name, stats->method->descriptor);
+
+        length = sort_opcodes(stats->opcodes, opcodes);
+        print_opcodes("    ", opcodes,
+                      at_most(length, OPCODE_STATS_METHOD_TOP),
+                      stats->instructions);
+
+        /* nothing is counted anymore, so the table is sorted in place */
+        length = 0;
+        for (u4 j = 0; j < stats->pair_capacity; j++)
+            if (stats->pairs[j].count)
+                stats->pairs[length++] = stats->pairs[j];
+        qsort(stats->pairs, length, sizeof(pair_count_t),
+              compare_pair_counts);
+        stats->pair_count = 0;
+        print_pairs("    ", stats->pairs,
+                    at_most(length, OPCODE_STATS_METHOD_TOP),
+                    stats->instructions);
+    }
+}
+
+void free_opcode_stats()
+{
+    for (size_t i = 0; i < methods.length; i++) {
+        methods.items[i]->method->opcode_stats = NULL;
+        free(methods.items[i]->pairs);
+        free(methods.items[i]);
+    }
+    free(methods.items);
+    methods.items = NULL;
+    methods.length = methods.capacity = 0;
+}
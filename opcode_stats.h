@@ -0,0 +1,50 @@
+#pragma once
+
+#include "java_file.h"
+
+/* opcode pairs listed for the whole program, and for each method */
+#define OPCODE_STATS_TOP_PAIRS 50
+#define OPCODE_STATS_METHOD_TOP 10
+
+typedef struct {
+    u2 pair; /* first opcode in the high byte */
+    u8 count; /* 0 for an empty slot */
+} pair_count_t;
+
+/**
+ * How many times each opcode of a method ran, and each pair of opcodes one
+ * after the other in a frame of the method. Only kept when built with
+ * OPCODE_STATS.
+ */
+typedef struct opcode_stats {
+    method_t *method;
+    class_file_t *clazz;
+    u8 instructions;
+    u8 opcodes[256];
+    pair_count_t *pairs; /* open addressing, keyed by pair */
+    u4 pair_capacity;
+    u4 pair_count;
+} opcode_stats_t;
+
+/* every method of the program together */
+extern u8 opcode_counts[256];
+extern u8 opcode_pair_counts[256][256];
+
+opcode_stats_t *method_opcode_stats(method_t *method, class_file_t *clazz);
+void count_method_pair(opcode_stats_t *stats, u2 pair);
+void report_opcode_stats();
+void free_opcode_stats();
+
+/* count the run of opcode after previous, negative at the entry of a method */
+static inline void count_opcode(opcode_stats_t *stats,
+                                int previous,
+                                u1 opcode)
+{
+    opcode_counts[opcode]++;
+    stats->instructions++;
+    stats->opcodes[opcode]++;
+    if (previous >= 0) {
+        opcode_pair_counts[previous][opcode]++;
+        count_method_pair(stats, previous << 8 | opcode);
+    }
+}
@@ -2,6 +2,7 @@
 
 #include "stack.h"
 
+frame_t *current_frame = NULL;
 
 void init_stack(stack_frame_t *stack, size_t entry_size)
 {
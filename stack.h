@@ -41,6 +41,26 @@ typedef struct {
 
 typedef stack_entry_t local_variable_t;
 
+/**
+ * An activation of an interpreted method. Frames are linked from the
+ * innermost one, so the references held in locals and operand stacks of
+ * every active method can be found.
+ */
+typedef struct frame {
+    struct method *method;
+    struct class_file *clazz; /* of the method */
+    u4 pc; /* of the instruction running, for profiling */
+    local_variable_t *locals;
+    u2 max_locals;
+    stack_frame_t *op_stack; /* NULL until the method starts running */
+    /* blocks of the objects allocated in the frame, NULL until used */
+    void **frame_objects;
+    u2 frame_object_count;
+    struct frame *prev;
+} frame_t;
+
+extern frame_t *current_frame;
+
 
 void init_stack(stack_frame_t *stack, size_t entry_size);
 void push_byte(stack_frame_t *stack, int8_t value);
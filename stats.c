@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE /* getrusage() */
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "object_heap.h"
+#include "stats.h"
+
+bool vm_stats = false;
+u8 method_calls = 0;
+u8 native_calls = 0;
+
+/**
+ * Summary of a run printed by -Xstats when the VM exits, on one line of
+ * name=value pairs for dashboards to track: the wall time of each phase,
+ * and counts of what the program did.
+ *
+ * The VM is in one phase at any time, enter_phase() charging the time
+ * since the last change to the phase left.
+ */
+
+static const char *phase_names[PHASE_COUNT] = {
+    [PHASE_OTHER] = "other",
+    [PHASE_BOOTSTRAP_LOAD] = "bootstrap_load",
+    [PHASE_BOOTSTRAP_CLINIT] = "bootstrap_clinit",
+    [PHASE_USER_LOAD] = "user_load",
+    [PHASE_INTERPRETER] = "interpreter",
+    [PHASE_TEARDOWN] = "teardown",
+};
+
+static struct {
+    vm_phase_t current;
+    u8 since; /* nanoseconds of CLOCK_MONOTONIC */
+    u8 start;
+    u8 elapsed[PHASE_COUNT];
+} phases;
+
+static u8 now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u8) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void init_vm_stats()
+{
+    if (!vm_stats)
+        return;
+    phases.current = PHASE_OTHER;
+    phases.start = phases.since = now();
+}
+
+/* switch to a phase, returning the one left. Class files parsed while
+ * loading the bootstrap classes count as bootstrap loading. */
+vm_phase_t enter_phase(vm_phase_t phase)
+{
+    if (!vm_stats)
+        return phase;
+    vm_phase_t left = phases.current;
+    if (phase == PHASE_USER_LOAD && left == PHASE_BOOTSTRAP_LOAD)
+        return left;
+    u8 time = now();
+    phases.elapsed[left] += time - phases.since;
+    phases.since = time;
+    phases.current = phase;
+    return left;
+}
+
+/* called last, once the VM is torn down */
+void report_vm_stats(int classes)
+{
+    if (!vm_stats)
+        return;
+    enter_phase(PHASE_OTHER);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "[Stats total_ms=%.3f",
+            (phases.since - phases.start) / 1e6);
+    for (int i = 0; i < PHASE_COUNT; i++)
+        fprintf(stderr, " %s_ms=%.3f", phase_names[i],
+                phases.elapsed[i] / 1e6);
+    size_t *kinds = object_heap.allocated_kinds;
+    fprintf(stderr,
+            " classes=%d method_calls=%llu native_calls=%llu objects=%zu "
+            "arrays=%zu strings=%zu allocated_bytes=%zu peak_rss_kb=%ld]\n",
+            classes, (unsigned long long) method_calls,
+            (unsigned long long) native_calls, kinds[OBJECT_INSTANCE],
+            kinds[OBJECT_ARRAY] + kinds[OBJECT_REF_ARRAY] +
+                kinds[OBJECT_MULTIARRAY],
+            kinds[OBJECT_STRING], object_heap.allocated_bytes,
+            usage.ru_maxrss);
+}
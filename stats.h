@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "type.h"
+
+/* what the VM is busy with, the time of each is reported by -Xstats */
+typedef enum {
+    PHASE_OTHER, /* option parsing, reports at exit */
+    PHASE_BOOTSTRAP_LOAD, /* load_native_class() */
+    PHASE_BOOTSTRAP_CLINIT,
+    PHASE_USER_LOAD, /* parse of the class files of the program */
+    PHASE_INTERPRETER,
+    PHASE_TEARDOWN,
+    PHASE_COUNT
+} vm_phase_t;
+
+/* -Xstats */
+extern bool vm_stats;
+
+/* counted whether -Xstats is given or not, as it costs next to nothing */
+extern u8 method_calls;
+extern u8 native_calls;
+
+void init_vm_stats();
+vm_phase_t enter_phase(vm_phase_t phase);
+void report_vm_stats(int classes);
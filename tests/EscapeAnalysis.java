@@ -0,0 +1,58 @@
+class Point {
+    int x;
+    int y;
+    Point next;
+
+    Point(int x, int y) {
+        this.x = x;
+        this.y = y;
+    }
+
+    int sum() {
+        return x + y;
+    }
+}
+
+public class EscapeAnalysis {
+    static Point saved;
+
+    static Point make(int x) {
+        return new Point(x, x);
+    }
+
+    static void keep(Point p) {
+        saved = p;
+    }
+
+    public static void main(String[] args) {
+        /* temporaries that never leave main */
+        int sum = 0;
+        for (int i = 0; i < 1000000; i++) {
+            Point p = new Point(i, 1);
+            sum += p.sum();
+        }
+        System.out.println(sum);
+
+        /* the object of the previous iteration is still in use */
+        Point prev = new Point(0, 0);
+        sum = 0;
+        for (int i = 1; i <= 1000; i++) {
+            Point p = new Point(i, prev.x);
+            sum += p.y;
+            prev = p;
+        }
+        System.out.println(sum);
+
+        /* objects escaping through a field, a static and a return, while
+         * young ones are kept by an object of the frame */
+        Point holder = new Point(0, 0);
+        sum = 0;
+        for (int i = 0; i < 100000; i++) {
+            holder.next = new Point(i, 2);
+            keep(new Point(i, 3));
+            sum += make(i).x + holder.next.y + saved.y;
+        }
+        System.out.println(sum);
+        System.out.println(holder.next.x + saved.x);
+    }
+}
@@ -0,0 +1,34 @@
+class Survivor {
+    int value;
+    Survivor next;
+}
+
+public class Fragmentation {
+    static Survivor kept;
+
+    public static void main(String[] args) {
+        /* each batch is promoted to the old space, where one object out of
+         * 2048 survives: the space is left mostly free, but never empty */
+        for (int round = 0; round < 100; round++) {
+            Survivor[] batch = new Survivor[40000];
+            for (int i = 0; i < batch.length; i++) {
+                batch[i] = new Survivor();
+                batch[i].value = round * 40000 + i;
+            }
+            for (int i = 0; i < batch.length; i += 2048) {
+                batch[i].next = kept;
+                kept = batch[i];
+            }
+        }
+
+        int count = 0;
+        int sum = 0;
+        for (Survivor survivor = kept; survivor != null;
+             survivor = survivor.next) {
+            count++;
+            sum += survivor.value;
+        }
+        System.out.println(count);
+        System.out.println(sum);
+    }
+}
@@ -0,0 +1,35 @@
+class Node {
+    int value;
+    Node next;
+}
+
+public class GarbageCollection {
+    static Node keep;
+
+    public static void main(String[] args) {
+        Node head = new Node();
+        for (int i = 1; i <= 100000; i++) {
+            Node node = new Node();
+            node.value = i;
+            node.next = head;
+            head = node;
+        }
+        keep = new Node();
+        keep.value = 777;
+
+        /* far more garbage than the object heap used to hold */
+        for (int i = 0; i < 1000000; i++) {
+            String s = "x" + i;
+            Node tmp = new Node();
+            tmp.value = s.length();
+        }
+
+        int sum = 0;
+        for (int i = 0; i < 100000; i++) {
+            sum += head.value;
+            head = head.next;
+        }
+        System.out.println(sum);
+        System.out.println(keep.value);
+    }
+}
@@ -0,0 +1,38 @@
+class Cell {
+    int value;
+    Cell next;
+}
+
+public class Generations {
+    static Cell last;
+
+    public static void main(String[] args) {
+        /* promoted to the old space by the first collections */
+        Cell[] table = new Cell[1000];
+        for (int i = 0; i < 1000; i++)
+            table[i] = new Cell();
+        int[][] rows = new int[100][];
+
+        /* old objects keep referring to young ones */
+        for (int i = 0; i < 1000000; i++) {
+            Cell cell = new Cell();
+            cell.value = i;
+            table[i % 1000].next = cell;
+            last = cell;
+            if (i % 1000 == 999) {
+                rows[i / 1000 % 100] = new int[10];
+                rows[i / 1000 % 100][0] = i;
+            }
+        }
+
+        int sum = 0;
+        for (int i = 0; i < 1000; i++)
+            sum += table[i].next.value;
+        System.out.println(sum);
+        sum = 0;
+        for (int i = 0; i < 100; i++)
+            sum += rows[i][0];
+        System.out.println(sum);
+        System.out.println(last.value);
+    }
+}
@@ -0,0 +1,42 @@
+public class MultiArrays {
+    public static void main(String[] args) {
+        int[][] grid = new int[3][5];
+        System.out.println(grid.length);
+        System.out.println(grid[0].length);
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 5; j++)
+                grid[i][j] = i * 10 + j;
+
+        long[][][] cube = new long[4][3][2];
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 3; j++)
+                for (int k = 0; k < 2; k++)
+                    cube[i][j][k] = i * 100 + j * 10 + k;
+        long total = 0;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 3; j++)
+                for (int k = 0; k < 2; k++)
+                    total += cube[i][j][k];
+        System.out.println("" + total);
+        System.out.println(cube[3][2].length);
+
+        int[][][] jagged = new int[2][3][];
+        System.out.println(jagged[1].length);
+        jagged[1][2] = new int[7];
+        System.out.println(jagged[1][2].length);
+
+        /* the arrays move out of the nursery while referring to young
+         * strings */
+        String[][] names = new String[2][2];
+        for (int i = 0; i < 200000; i++)
+            names[i % 2][i % 2] = "v" + i;
+        System.out.println(names[0][0]);
+        System.out.println(names[1][1]);
+
+        int sum = 0;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 5; j++)
+                sum += grid[i][j];
+        System.out.println(sum);
+    }
+}
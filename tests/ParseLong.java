@@ -0,0 +1,12 @@
+public class ParseLong {
+    public static void main(String[] args) {
+        System.out.println("" + Long.parseLong("0"));
+        System.out.println("" + Long.parseLong("-0"));
+        System.out.println("" + Long.parseLong("+42"));
+        System.out.println("" + Long.parseLong("-42"));
+        System.out.println("" + Long.parseLong("007"));
+        System.out.println("" + Long.parseLong("12345678901"));
+        System.out.println("" + Long.parseLong("9223372036854775807"));
+        System.out.println("" + Long.parseLong("-9223372036854775808"));
+    }
+}
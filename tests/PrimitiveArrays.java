@@ -0,0 +1,52 @@
+public class PrimitiveArrays {
+    public static void main(String[] args) {
+        byte[] bytes = new byte[300];
+        for (int i = 0; i < bytes.length; i++)
+            bytes[i] = (byte) i;
+        int sum = 0;
+        for (int i = 0; i < bytes.length; i++)
+            sum += bytes[i];
+        System.out.println(sum);
+
+        char[] chars = new char[26];
+        for (int i = 0; i < chars.length; i++)
+            chars[i] = (char) ('a' + i);
+        sum = 0;
+        for (int i = 0; i < chars.length; i++)
+            sum += chars[i];
+        System.out.println(sum);
+
+        short[] shorts = new short[10];
+        for (int i = 0; i < shorts.length; i++)
+            shorts[i] = (short) (i * 40000);
+        sum = 0;
+        for (int i = 0; i < shorts.length; i++)
+            sum += shorts[i];
+        System.out.println(sum);
+
+        long[] longs = new long[50];
+        for (int i = 0; i < longs.length; i++)
+            longs[i] = i * 1000000000L;
+        long total = 0;
+        for (int i = 0; i < longs.length; i++)
+            total += longs[i];
+        System.out.println("" + total);
+
+        boolean[] flags = new boolean[100];
+        for (int i = 0; i < flags.length; i += 3)
+            flags[i] = true;
+        sum = 0;
+        for (int i = 0; i < flags.length; i++) {
+            if (flags[i])
+                sum++;
+        }
+        System.out.println(sum);
+
+        int[] ints = new int[0];
+        System.out.println(ints.length);
+
+        /* ends the program with a NullPointerException */
+        int[] missing = null;
+        System.out.println(missing.length);
+    }
+}
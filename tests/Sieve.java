@@ -0,0 +1,22 @@
+public class Sieve {
+    public static void main(String[] args) {
+        int n = 2000000;
+        boolean[] composite = new boolean[n];
+        int count = 0;
+        for (int i = 2; i < n; i++) {
+            if (!composite[i]) {
+                count++;
+                if (i <= n / i) {
+                    for (int j = i * i; j < n; j += i)
+                        composite[j] = true;
+                }
+            }
+        }
+        System.out.println(count);
+
+        /* only the pages touched are ever backed by memory */
+        int[] sparse = new int[50000000];
+        sparse[sparse.length - 1] = 7;
+        System.out.println(sparse[0] + sparse[sparse.length - 1]);
+    }
+}
@@ -0,0 +1,23 @@
+public class StringBuilding {
+    public static void main(String[] args) {
+        StringBuilder sb = new StringBuilder();
+        for (int i = 0; i < 100000; i++) {
+            sb.append(i % 10);
+            sb.append(',');
+        }
+        System.out.println(sb.length());
+        System.out.println(sb.toString().length());
+
+        sb.setLength(20);
+        sb.append(10L);
+        System.out.println(sb.toString());
+
+        StringBuilder words = new StringBuilder("count:");
+        words.append(' ').append(-42).append(" and ").append(9223372036854775807L);
+        System.out.println(words.toString());
+        words.setLength(5);
+        System.out.println(words.toString());
+        if (words.toString().equals("count"))
+            System.out.println("equal");
+    }
+}
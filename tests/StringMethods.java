@@ -0,0 +1,41 @@
+public class StringMethods {
+    public static void main(String[] args) {
+        String a = "Hello";
+        String h = "Hel";
+        String b = h + "lo";
+        System.out.println(a.length());
+        System.out.println("".length());
+        System.out.println(a.hashCode());
+        System.out.println(b.hashCode());
+        System.out.println("".hashCode());
+        if (a.equals(b))
+            System.out.println("equal");
+        if (!a.equals("World"))
+            System.out.println("not equal");
+        Object object = new StringMethods();
+        if (!a.equals(object))
+            System.out.println("not equal to an object");
+        Object builder = new StringBuilder(a);
+        if (!a.equals(builder))
+            System.out.println("not equal to a builder");
+        Object array = new int[5];
+        if (!a.equals(array))
+            System.out.println("not equal to an array");
+        if (!a.equals(null))
+            System.out.println("not equal to null");
+        Object same = b;
+        if (a.equals(same))
+            System.out.println("equal as an object");
+        System.out.println(a.compareTo("Help"));
+        System.out.println("Hell".compareTo(a));
+        System.out.println(a.compareTo(b));
+        String text = "the quick brown fox jumps over the lazy dog";
+        System.out.println(text.indexOf('q'));
+        System.out.println(text.indexOf('z'));
+        System.out.println(text.indexOf('!'));
+        System.out.println(text.indexOf("the"));
+        System.out.println(text.indexOf("lazy dog"));
+        System.out.println(text.indexOf("cat"));
+        System.out.println(text.indexOf(""));
+    }
+}
@@ -11,5 +11,7 @@ public class Strings {
         System.out.println("prefix " + str4 + " postfix");
         System.out.println("1" + 2 + 5 + 3.8 + str2 + "2");
         System.out.println(str1 + str2 + str3 + str4);
+        Object object = str3;
+        System.out.println("object " + object);
     }
 }
@@ -0,0 +1,25 @@
+public class Unicode {
+    public static void main(String[] args) {
+        String latin = "héllo";
+        String cjk = "日本語";
+        String emoji = "😀";
+        System.out.println(latin.length());
+        System.out.println((int) latin.charAt(1));
+        System.out.println(latin.hashCode());
+        System.out.println(cjk.length());
+        System.out.println((int) cjk.charAt(2));
+        System.out.println(cjk.hashCode());
+        System.out.println(emoji.length());
+        System.out.println((int) emoji.charAt(1));
+        System.out.println("a\u0000b".length());
+        System.out.println(latin.compareTo(cjk));
+        String mixed = latin + 42 + cjk;
+        System.out.println(mixed.length());
+        System.out.println(mixed.hashCode());
+        if (mixed.equals("héllo42日本語"))
+            System.out.println("equal");
+        char wide = 'Ā';
+        String widened = "x" + wide;
+        System.out.println((int) widened.charAt(1));
+    }
+}
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gc.h"
+#include "trace.h"
+
+bool tracing = false;
+char *trace_path = NULL;
+long trace_method_threshold_us = TRACE_METHOD_THRESHOLD;
+
+/**
+ * Timeline of what the VM spends time on, written in the trace event format
+ * of Chrome, which chrome://tracing and Perfetto open. Spans are recorded
+ * for the parse of every class file, every <clinit>, every method running
+ * for longer than trace_method_threshold_us, and the phases of garbage
+ * collections, including the part of the work done by each collector
+ * worker.
+ *
+ * Each thread records its spans in a ring buffer of its own, so recording
+ * takes no lock. Buffers are registered once, by an atomic increment, and
+ * only read when the program is over and no other thread runs.
+ */
+
+typedef struct {
+    u8 start; /* nanoseconds of CLOCK_MONOTONIC */
+    u8 end;
+    const char *category;
+    const char *name;
+    const char *detail; /* appended to the name when not NULL */
+    method_t *method;   /* for the spans of methods */
+    class_file_t *clazz;
+} trace_event_t;
+
+typedef struct {
+    int tid;
+    u8 written; /* events ever recorded, the last ones are kept */
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+} trace_buffer_t;
+
+/* one per thread that recorded something, the first one of main */
+static trace_buffer_t *buffers[GC_MAX_THREADS];
+static int buffer_count;
+static __thread trace_buffer_t *thread_buffer;
+static u8 trace_start;
+
+u8 trace_clock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u8) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static trace_buffer_t *own_buffer()
+{
+    if (thread_buffer)
+        return thread_buffer;
+    int index = __atomic_fetch_add(&buffer_count, 1, __ATOMIC_RELAXED);
+    if (index >= GC_MAX_THREADS)
+        return NULL;
+    trace_buffer_t *buffer = malloc(sizeof(trace_buffer_t));
+    assert(buffer && "Failed to allocate trace buffer");
+    buffer->tid = index + 1;
+    buffer->written = 0;
+    __atomic_store_n(&buffers[index], buffer, __ATOMIC_RELEASE);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+/* called on the thread running the program, which gets the first buffer */
+void init_trace()
+{
+    if (!tracing)
+        return;
+    trace_start = trace_clock();
+    own_buffer();
+}
+
+static trace_event_t *record(const char *category, u8 start)
+{
+    trace_buffer_t *buffer = own_buffer();
+    if (!buffer)
+        return NULL;
+    trace_event_t *event =
+        &buffer->events[buffer->written++ % TRACE_BUFFER_EVENTS];
+    event->start = start;
+    event->end = trace_clock();
+    event->category = category;
+    event->name = NULL;
+    event->detail = NULL;
+    event->method = NULL;
+    event->clazz = NULL;
+    return event;
+}
+
+/* record a span from start to now, named after name and detail if any */
+void trace_span(const char *category,
+                const char *name,
+                const char *detail,
+                u8 start)
+{
+    if (!tracing)
+        return;
+    trace_event_t *event = record(category, start);
+    if (event) {
+        event->name = name;
+        event->detail = detail;
+    }
+}
+
+/* record the run of a method from start to now, if it is worth it */
+void trace_method(method_t *method, class_file_t *clazz, u8 start)
+{
+    bool initializer = !strcmp(method->name, "<clinit>");
+    if (!initializer &&
+        trace_clock() - start < (u8) trace_method_threshold_us * 1000)
+        return;
+    trace_event_t *event = record(initializer ? "clinit" : "method", start);
+    if (event) {
+        event->method = method;
+        event->clazz = clazz;
+    }
+}
+
+static void write_json_string(FILE *file, const char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(file, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, file);
+    }
+}
+
+static void write_event(FILE *file, int tid, trace_event_t *event)
+{
+    fprintf(file, ",\n{\"ph\":\"X\",\"pid\":%ld,\"tid\":%d,\"cat\":\"%s\",",
+            (long) getpid(), tid, event->category);
+    fprintf(file, "\"ts\":%.3f,\"dur\":%.3f,\"name\":\"",
+            (event->start - trace_start) / 1000.0,
+            (event->end - event->start) / 1000.0);
+    if (event->method) {
+        write_json_string(file, find_class_name_from_index(
+                                    event->clazz->this_class, event->clazz));
+        fputc('.', file);
+        write_json_string(file, event->method->name);
+        fprintf(file, "\",\"args\":{\"descriptor\":\"");
+        write_json_string(file, event->method->descriptor);
+        fprintf(file, "\"}}");
+        return;
+    }
+    write_json_string(file, event->name);
+    if (event->detail) {
+        fputc(' ', file);
+        write_json_string(file, event->detail);
+    }
+    fprintf(file, "\"}");
+}
+
+/* write the spans recorded, once the program is over */
+void write_trace()
+{
+    if (!tracing)
+        return;
+    char default_path[40];
+    snprintf(default_path, sizeof(default_path), "java_pid%ld.trace.json",
+             (long) getpid());
+    const char *path = trace_path ? trace_path : default_path;
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Unable to create %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file,
+            "{\"ph\":\"M\",\"pid\":%ld,\"name\":\"process_name\","
+            "\"args\":{\"name\":\"jvm\"}}",
+            (long) getpid());
+    int count = buffer_count < GC_MAX_THREADS ? buffer_count : GC_MAX_THREADS;
+    for (int i = 0; i < count; i++) {
+        trace_buffer_t *buffer = buffers[i];
+        fprintf(file,
+                ",\n{\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,"
+                "\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                (long) getpid(), buffer->tid,
+                i ? "GC worker" : "main");
+        u8 first = buffer->written > TRACE_BUFFER_EVENTS
+                       ? buffer->written - TRACE_BUFFER_EVENTS
+                       : 0;
+        for (u8 j = first; j < buffer->written; j++)
+            write_event(file, buffer->tid,
+                        &buffer->events[j % TRACE_BUFFER_EVENTS]);
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file))
+        fprintf(stderr, "Unable to write %s\n", path);
+}
+
+void free_trace()
+{
+    int count = buffer_count < GC_MAX_THREADS ? buffer_count : GC_MAX_THREADS;
+    for (int i = 0; i < count; i++)
+        free(buffers[i]);
+    buffer_count = 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "java_file.h"
+
+/* events a thread keeps, the oldest ones being overwritten */
+#define TRACE_BUFFER_EVENTS (32 * 1024)
+/* default -XX:TraceMethodThreshold, in microseconds */
+#define TRACE_METHOD_THRESHOLD 1000
+
+/* -XX:+TraceEvents, or -XX:TraceEventPath */
+extern bool tracing;
+/* -XX:TraceEventPath, java_pid<pid>.trace.json when NULL */
+extern char *trace_path;
+/* -XX:TraceMethodThreshold, shorter method runs are not traced */
+extern long trace_method_threshold_us;
+
+void init_trace();
+u8 trace_clock();
+void trace_span(const char *category,
+                const char *name,
+                const char *detail,
+                u8 start);
+void trace_method(method_t *method, class_file_t *clazz, u8 start);
+void write_trace();
+void free_trace();
+
+/* time a span starts, 0 unless tracing */
+static inline u8 trace_now()
+{
+    return tracing ? trace_clock() : 0;
+}